@@ -0,0 +1,1353 @@
+/* vim: set tabstop=2:softtabstop=2:shiftwidth=2:expandtab */
+
+// microbenchmarks for the hot paths of the game. build and run with
+// "make bench", or only some of them with "worm-bench NAME...". with
+// "--json" the results come as a JSON array instead, "make bench-json" keeps
+// them in bench-VERSION.json to compare releases.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <new>
+#include <vector>
+#include <algorithm>
+
+#include "grid.h"
+#include "wormbody.h"
+#include "game.h"
+#include "network.h"
+#include "netthread.h"
+#include "computer.h"
+#include "scheduler.h"
+#include "spectate.h"
+#include "render.h"
+
+using namespace std;
+
+// a sink the compiler can't see through, so the measured work isn't dropped
+volatile long bench_sink;
+
+// every allocation of the process, the benchmarks' own threads included
+atomic<long> allocations(0);
+
+// both out of line, or gcc sees malloc() and free() behind new and delete
+// and takes them for a mismatch
+__attribute__((noinline)) void* operator new(size_t size) {
+  allocations.fetch_add(1, memory_order_relaxed);
+  void* memory = malloc(size ? size : 1);
+  if(!memory) throw bad_alloc();
+  return memory;
+}
+
+__attribute__((noinline)) void operator delete(void* memory) noexcept {
+  free(memory);
+}
+
+// what a call costs
+struct timing {
+  double ns;
+  double allocs;
+};
+
+// run fn until at least min_seconds passed and return the cost per call
+template<typename F> timing measure(F fn, double min_seconds = 0.2) {
+  long iterations = 1;
+  while(true) {
+    long allocated = allocations;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(long i = 0; i < iterations; i++) fn();
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    if(elapsed.count() >= min_seconds) {
+      timing result = {elapsed.count() * 1e9 / iterations,
+                       (double)(allocations - allocated) / iterations};
+      return result;
+    }
+    iterations *= 2;
+  }
+}
+
+bool json_output = false;
+int json_results = 0;
+
+void report_json(const char* name, int width, int height, const char* what, int count, timing t,
+                 const char* measured = NULL, double value = 0) {
+  // one object of the array, the fields that don't apply are left out
+  printf("%s\n  {\"name\": \"%s\"", json_results++ ? "," : "[", name);
+  if(width) printf(", \"width\": %d, \"height\": %d", width, height);
+  if(what) printf(", \"%s\": %d", what, count);
+  if(measured) printf(", \"%s\": %.1f", measured, value);
+  printf(", \"ns_per_op\": %.1f, \"allocs_per_op\": %.3f}", t.ns, t.allocs);
+}
+
+void report(const char* name, int length, timing t) {
+  if(json_output) return report_json(name, 0, 0, "length", length, t);
+  printf("%-28s length %-7d %12.1f ns/op %8.2f allocs/op\n", name, length, t.ns, t.allocs);
+}
+
+void report_board(const char* name, int width, int height, timing t,
+                  const char* what = NULL, int count = 0) {
+  // for whole-board passes the cells per second say more than ns per pass,
+  // the others tell what else they depend on
+  if(json_output) return report_json(name, width, height, what, count, t);
+  if(what) {
+    printf("%-28s %5dx%-5d %12.1f ns/op %8.2f allocs/op %s %d\n",
+           name, width, height, t.ns, t.allocs, what, count);
+  }
+  else {
+    printf("%-28s %5dx%-5d %12.1f ns/op %8.2f allocs/op %8.2f Gcells/s\n",
+           name, width, height, t.ns, t.allocs, width*(double)height / t.ns);
+  }
+}
+
+// the worm body as it used to be: one heap object per piece ------------------
+struct linked_piece {
+  int pos_x, pos_y;
+  linked_piece* connected_to;
+};
+
+struct linked_worm {
+  linked_piece* head;
+  int max_wormlength;
+
+  linked_worm(int length) {
+    head = NULL;
+    max_wormlength = length;
+    for(int i = 0; i < length; i++) advance();
+  }
+  ~linked_worm(void) {
+    while(head) {
+      linked_piece* next = head->connected_to;
+      delete head;
+      head = next;
+    }
+  }
+  void advance(void) {
+    // new head, then walk the worm and cut it behind max_wormlength
+    linked_piece* piece = new linked_piece;
+    piece->pos_x = head ? head->pos_x + 1 : 0;
+    piece->pos_y = 0;
+    piece->connected_to = head;
+    head = piece;
+    int wormlength = 0;
+    long sum = 0;
+    while(piece) {
+      sum += piece->pos_x;
+      wormlength++;
+      if(wormlength == max_wormlength) {
+        if(piece->connected_to) delete piece->connected_to;
+        piece->connected_to = 0;
+      }
+      piece = piece->connected_to;
+    }
+    bench_sink = sum;
+  }
+};
+
+// the ring buffer body, walked like player::move() repaints it ---------------
+struct ring_worm {
+  wormbody body;
+  int max_wormlength;
+
+  ring_worm(int length) {
+    max_wormlength = length;
+    body.push_head(0, 0);
+    for(int i = 1; i < length; i++) advance();
+  }
+  void advance(void) {
+    body.push_head(body.head().pos_x + 1, 0);
+    while(body.length() > max_wormlength) body.pop_tail();
+    long sum = 0;
+    for(int i = 0; i < body.length(); i++) sum += body.at(i).pos_x;
+    bench_sink = sum;
+  }
+  void advance_only(void) {
+    body.push_head(body.head().pos_x + 1, 0);
+    while(body.length() > max_wormlength) body.pop_tail();
+    bench_sink = body.head().pos_x;
+  }
+};
+
+void bench_wormbody(void) {
+  const int lengths[] = {10, 1000, 100000};
+  for(int l = 0; l < 3; l++) {
+    int length = lengths[l];
+    linked_worm old_worm(length);
+    report("move linked list + walk", length, measure([&]{old_worm.advance();}));
+    ring_worm new_worm(length);
+    report("move ring buffer + walk", length, measure([&]{new_worm.advance();}));
+    report("move ring buffer", length, measure([&]{new_worm.advance_only();}));
+  }
+}
+
+// playground as int per cell versus the grid ---------------------------------
+template<typename T> long scan(const T* cells, int size) {
+  // what the render loop does per cell: branch on the kind of the cell
+  long drawn = 0;
+  for(int p = 0; p < size; p++) {
+    switch(cell_kind(cells[p])) {
+      case WALL: drawn += 1; break;
+      case WORMHEAD: drawn += 2; break;
+      case WORM: drawn += 3; break;
+      case FOOD: drawn += 4; break;
+    }
+  }
+  return drawn;
+}
+
+void fill_randomly(grid& board, int* ints) {
+  // about a quarter of the cells taken, like a busy round
+  srand(1);
+  for(int p = 0; p < board.size(); p++) {
+    cellvalue cell = (rand() % 4) ? 0 : make_cell(1 + rand() % 4, rand() % 3);
+    board.cells[p] = cell;
+    ints[p] = cell;
+  }
+}
+
+void bench_grid(void) {
+  const int sizes[][2] = {{200, 50}, {1000, 1000}, {4000, 4000}};
+  for(int s = 0; s < 3; s++) {
+    int width = sizes[s][0], height = sizes[s][1];
+    grid board;
+    board.resize(width, height);
+    int* ints = new int [board.size()];
+    fill_randomly(board, ints);
+    report_board("render scan int", width, height,
+      measure([&]{bench_sink = scan(ints, board.size());}));
+    report_board("render scan grid", width, height,
+      measure([&]{bench_sink = scan(board.cells, board.size());}));
+    report_board("clear int", width, height, measure([&]{
+      for(int p = 0; p < board.size(); p++) ints[p] = 0;
+      bench_sink = ints[board.size()-1];
+    }));
+    report_board("clear grid", width, height, measure([&]{
+      board.clear();
+      bench_sink = board[board.size()-1];
+    }));
+    delete[] ints;
+  }
+}
+
+// the questions about the whole board, cells against bitboards ---------------
+int flood_cells(const grid& board, int from, vector<int>& queue, vector<uint8_t>& seen) {
+  // breadth first from cell to cell, as the A* of computer.cpp goes
+  seen.assign(board.size(), 0);
+  queue.clear();
+  queue.push_back(from);
+  seen[from] = 1;
+  for(size_t i = 0; i < queue.size(); i++) {
+    int pos = queue[i];
+    int x = pos % board.width, y = pos / board.width;
+    int around[4] = {y * board.width + (x + 1) % board.width,
+                     y * board.width + (x + board.width - 1) % board.width,
+                     ((y + 1) % board.height) * board.width + x,
+                     ((y + board.height - 1) % board.height) * board.width + x};
+    for(int n = 0; n < 4; n++) {
+      int next = around[n];
+      int kind = cell_kind(board[next]);
+      if(seen[next] || kind == WALL || kind == WORM || kind == WORMHEAD) continue;
+      seen[next] = 1;
+      queue.push_back(next);
+    }
+  }
+  return queue.size();
+}
+
+void bench_bitboard(void) {
+  // level 3 with worms lying about and some food. every bitboard level has
+  // to come out as the cells say
+  const int sides[] = {100, 500, 1000, 2000};
+  simd_levels best = bitboard_simd;
+  for(int s = 0; s < 4; s++) {
+    int width = sides[s], height = sides[s];
+    grid board;
+    board.resize(width, height);
+    play_x = width;
+    play_y = height;
+    prng where(1);
+    // draw_level() draws on the playground, it's copied over
+    playground.resize(width, height);
+    draw_level(3);
+    for(int p = 0; p < board.size(); p++) board.set(p, playground[p]);
+    for(int worm = 0; worm < board.size() / 40; worm++) {
+      int pos = where.below(board.size()), down = where.below(2);
+      for(int piece = 0; piece < 8 && !board[pos]; piece++) {
+        board.set(pos, make_cell(WORM, 1));
+        pos = down ? (pos + width) % board.size() : pos / width * width + (pos + 1) % width;
+      }
+    }
+    for(int piece = 0; piece < board.size() / 100; piece++) {
+      int pos = where.below(board.size());
+      if(!board[pos]) board.set(pos, make_cell(FOOD));
+    }
+    int from = board.free_cell(0);
+
+    vector<cellvalue> cells(board.size());
+    report_board("clear cells", width, height, measure([&]{
+      memset(cells.data(), 0, cells.size() * sizeof(cellvalue));
+      bench_sink = cells[0];
+    }));
+    bitboard walls, worms, food_bits, blocked, reached;
+    walls.resize(width, height);
+    worms.resize(width, height);
+    food_bits.resize(width, height);
+    blocked.resize(width, height);
+    reached.resize(width, height);
+    report_board("clear 3 bitboards", width, height, measure([&]{
+      walls.clear();
+      worms.clear();
+      food_bits.clear();
+      bench_sink = walls.test(0);
+    }));
+
+    vector<uint8_t> in_the_way(board.size());
+    report_board("obstacles cells", width, height, measure([&]{
+      for(int p = 0; p < board.size(); p++) {
+        int kind = cell_kind(board[p]);
+        in_the_way[p] = (kind == WALL || kind == WORM || kind == WORMHEAD);
+      }
+      bench_sink = in_the_way[0];
+    }));
+    report_board("free count cells", width, height, measure([&]{
+      int free = 0;
+      for(int p = 0; p < board.size(); p++) free += !board[p];
+      bench_sink = free;
+    }));
+    vector<int> queue;
+    vector<uint8_t> seen;
+    int cells_reached = 0;
+    report_board("flood cells", width, height, measure([&]{
+      cells_reached = flood_cells(board, from, queue, seen);
+    }));
+
+    for(int level = simd_scalar; level <= best; level++) {
+      bitboard_simd = (simd_levels)level;
+      char name[40];
+      snprintf(name, sizeof(name), "obstacles bits %s", SIMD_NAMES[level]);
+      report_board(name, width, height, measure([&]{
+        blocked.unite(board.wall_bits, board.worm_bits);
+        bench_sink = blocked.test(0);
+      }));
+      long free = 0;
+      snprintf(name, sizeof(name), "free count bits %s", SIMD_NAMES[level]);
+      report_board(name, width, height, measure([&]{
+        free = board.size() - board.wall_bits.count() - board.worm_bits.count() - board.food_bits.count();
+        bench_sink = free;
+      }));
+      long bits_reached = 0;
+      snprintf(name, sizeof(name), "flood bits %s", SIMD_NAMES[level]);
+      report_board(name, width, height, measure([&]{
+        reached.clear();
+        reached.set(from);
+        reached.flood(blocked);
+        bench_sink = reached.test(0);
+      }));
+      bits_reached = reached.count();
+      if(free != board.free_count() || bits_reached != cells_reached) {
+        fprintf(stderr, "bitboard %s: %ld free and %ld reached, the cells say %d and %d\n",
+                SIMD_NAMES[level], free, bits_reached, board.free_count(), cells_reached);
+        exit(1);
+      }
+    }
+    bitboard_simd = best;
+  }
+}
+
+// levels drawn wall by wall against a copy of the compiled one ---------------
+bool same_board(const grid& a, const grid& b) {
+  // the free cells in the same order too, food spawns by that
+  if(a.size() != b.size() || a.free_count() != b.free_count()) return false;
+  if(memcmp(a.cells, b.cells, a.size() * sizeof(cellvalue))) return false;
+  for(int i = 0; i < a.free_count(); i++) {
+    if(a.free_cell(i) != b.free_cell(i)) return false;
+  }
+  return a.wall_bits.count() == b.wall_bits.count();
+}
+
+void bench_level(void) {
+  // level 3 and a maze of 64x32 stretched over the board. drawing is what
+  // every round start did before, put_level() copies the compiled one
+  string maze = "level maze\nmap 64 32\n";
+  prng where(7);
+  for(int y = 0; y < 32; y++) {
+    for(int x = 0; x < 64; x++) maze += (y % 4 == 0 && where.below(4)) || (x % 8 == 0 && where.below(3)) ? '#' : '.';
+    maze += '\n';
+  }
+  level_count();
+  parse_levels(maze.data(), maze.size(), levels);
+  const int numbers[] = {3, (int)levels.size() - 1};
+  const int sizes[][2] = {{200, 50}, {1000, 1000}, {2000, 2000}};
+  for(int s = 0; s < 3; s++) {
+    int width = sizes[s][0], height = sizes[s][1];
+    for(int n = 0; n < 2; n++) {
+      int number = numbers[n];
+      char name[64];
+      grid drawn, copied;
+      snprintf(name, sizeof(name), "draw %s", levels[number].name.c_str());
+      report_board(name, width, height, measure([&]{
+        drawn.resize(width, height);
+        draw_shapes(drawn, levels[number]);
+        drawn.forget_changes();
+      }));
+      snprintf(name, sizeof(name), "put_level %s", levels[number].name.c_str());
+      report_board(name, width, height, measure([&]{put_level(copied, number, width, height);}));
+      if(!same_board(drawn, copied)) printf("MISMATCH %s %dx%d\n", levels[number].name.c_str(), width, height);
+    }
+  }
+  levels.pop_back();
+  forget_levels();
+}
+
+// food as it used to be: a list that is walked every tick --------------------
+class listed_food {
+  public:
+    int pos, countdown;
+    listed_food* next;
+};
+
+class food_list {
+  public:
+    food_list(void) {first = NULL;}
+    ~food_list(void) {while(first) remove(&first);}
+    void add(int pos) {
+      listed_food* piece = new listed_food;
+      piece->pos = pos;
+      piece->countdown = 100;
+      piece->next = first;
+      first = piece;
+    }
+    int length(void) {
+      int count = 0;
+      for(listed_food* piece = first; piece; piece = piece->next) count++;
+      return count;
+    }
+    void tick(int head1, int head2) {
+      // count down every piece, check it against every head
+      listed_food** link = &first;
+      while(*link) {
+        listed_food* piece = *link;
+        if(piece->countdown > 0 && piece->pos != head1 && piece->pos != head2) {
+          piece->countdown--;
+          link = &piece->next;
+        }
+        else remove(link);
+      }
+    }
+
+  private:
+    void remove(listed_food** link) {
+      listed_food* piece = *link;
+      *link = piece->next;
+      delete piece;
+    }
+    listed_food* first;
+};
+
+void bench_food(void) {
+  // a tick of food on a big board: expire, two worms look for food under
+  // their heads, and what's gone is spawned again
+  const int amounts[] = {3, 300, 30000};
+  for(int a = 0; a < 3; a++) {
+    int amount = amounts[a];
+    grid board;
+    board.resize(1000, 1000);
+    prng where(1);
+    food_list old_food;
+    report("food list tick", amount, measure([&]{
+      old_food.tick(where.below(board.size()), where.below(board.size()));
+      for(int missing = amount - old_food.length(); missing > 0; missing--) {
+        old_food.add(where.below(board.size()));
+      }
+    }));
+    food_manager new_food;
+    new_food.reset(board);
+    report("food manager tick", amount, measure([&]{
+      new_food.advance();
+      new_food.eat(where.below(board.size()));
+      new_food.eat(where.below(board.size()));
+      while(new_food.count() < amount) {
+        new_food.place(board.free_cell(where.below(board.free_count())));
+      }
+    }));
+  }
+}
+
+// the parts of a tick on the real playground ----------------------------------
+void bench_round(int width, int height, int number_of_players) {
+  // an empty level with the worms heading along their rows
+  play_x = width;
+  play_y = height;
+  level = 0;
+  gamemode = (number_of_players == 1) ? single : local_multi;
+  player_count = number_of_players;
+  match_random.seed(1);
+  new_round();
+  gamestate = running;
+}
+
+void bench_tick(void) {
+  const int sizes[][2] = {{200, 50}, {1000, 1000}, {4000, 4000}};
+  const int lengths[] = {10, 150, 3000};
+  for(int s = 0; s < 3; s++) {
+    int width = sizes[s][0], height = sizes[s][1];
+    // a worm going round its row, never into itself
+    for(int l = 0; l < 3; l++) {
+      int length = lengths[l];
+      if(length >= width) continue;
+      bench_round(width, height, 1);
+      player1->max_wormlength = length;
+      for(int i = 0; i < length; i++) {
+        player1->pull_tail();
+        player1->plan();
+        player1->move();
+      }
+      report_board("player move", width, height, measure([&]{
+        player1->pull_tail();
+        player1->plan();
+        player1->move();
+      }), "length", length);
+      report_board("player collision", width, height, measure([&]{
+        bench_sink = player1->collision();
+      }), "length", length);
+    }
+
+    // two worms standing still with food coming and going around them
+    const int amounts[] = {3, 300, 30000};
+    for(int a = 0; a < 3; a++) {
+      if(amounts[a] * 4 > width * height) continue;
+      bench_round(width, height, 2);
+      food_count = amounts[a];
+      report_board("food update + spawn", width, height, measure([&]{
+        update_food();
+        spawn_food();
+      }), "food", food_count);
+    }
+    food_count = 3;
+
+    report_board("draw_level 3", width, height, measure([&]{draw_level(3);}));
+  }
+  food.clear();
+  clear_players();
+}
+
+// the playground from host to client -----------------------------------------
+void bench_sync(void) {
+  // a frame is encoded, written to a socket, read on the other end by a
+  // thread of its own and applied to its copy of the playground
+  const int sizes[][2] = {{200, 50}, {1000, 1000}, {4000, 4000}};
+  for(int s = 0; s < 3; s++) {
+    int width = sizes[s][0], height = sizes[s][1];
+    int fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) error("socketpair");
+    network host, client;
+    host.fd = fds[0];
+    client.fd = fds[1];
+    host.is_connected = client.is_connected = true;
+
+    grid sent, received;
+    sent.resize(width, height);
+    received.resize(width, height);
+    prng where(1);
+    for(int p = 0; p < sent.size(); p++) {
+      if(!where.below(4)) sent.set(p, make_cell(1 + where.below(4), where.below(3)));
+    }
+
+    thread receiving([&]{
+      message frame;
+      int length;
+      while(client.read_all(&length, 4) && length > 0) {
+        frame.resize(length);
+        if(!client.read_all(&frame[0], length)) break;
+        size_t at = 0;
+        apply_playground(received, frame, at);
+        received.forget_changes();
+      }
+    });
+
+    message frame;
+    int length;
+    report_board("sync keyframe", width, height, measure([&]{
+      frame.clear();
+      encode_playground(sent, true, frame);
+      length = frame.size();
+      host.write_all(&length, 4);
+      host.write_all(&frame[0], length);
+    }));
+    // about what two worms and some food change in a tick
+    const int changes = 8;
+    sent.forget_changes();
+    report_board("sync delta", width, height, measure([&]{
+      for(int i = 0; i < changes; i++) {
+        sent.set(where.below(sent.size()), make_cell(WORM, 1 + where.below(2)));
+      }
+      frame.clear();
+      encode_playground(sent, false, frame);
+      sent.forget_changes();
+      length = frame.size();
+      host.write_all(&length, 4);
+      host.write_all(&frame[0], length);
+    }), "changes", changes);
+
+    length = 0;
+    host.write_all(&length, 4);
+    receiving.join();
+  }
+}
+
+// a tick and the answer to it over TCP on loopback ------------------------------
+void tcp_loopback(int* fds) {
+  // fds[0] and fds[1] are the two ends of one connection
+  int listening = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  if(bind(listening, (struct sockaddr*)&address, length) == -1) error("bind");
+  if(listen(listening, 1) == -1) error("listen");
+  getsockname(listening, (struct sockaddr*)&address, &length);
+  fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+  if(connect(fds[0], (struct sockaddr*)&address, length) == -1) error("connect");
+  fds[1] = accept(listening, NULL, NULL);
+  close(listening);
+}
+
+void bench_wire(void) {
+  // the host sends a tick, the client answers with a turn and the host
+  // waits for that. the old way is a write for the length of a message and
+  // one for the message, with Nagle on. the new way is what network does now
+  const int sizes[] = {100, 10000};
+  for(int s = 0; s < 2; s++) {
+    int size = sizes[s];
+    message tick(size, 1), turn(8, 2);
+    for(int old_way = 1; old_way >= 0; old_way--) {
+      int fds[2];
+      tcp_loopback(fds);
+      network host, client;
+      host.fd = fds[0];
+      client.fd = fds[1];
+      host.is_connected = client.is_connected = true;
+      if(!old_way) {
+        set_nodelay(host.fd);
+        set_nodelay(client.fd);
+      }
+      thread answering([&]{
+        message received;
+        while(true) {
+          if(old_way) {
+            int length;
+            if(!client.read_all(&length, 4) || length <= 0) break;
+            received.resize(length);
+            client.read_all(&received[0], length);
+            length = turn.size();
+            client.write_all(&length, 4);
+            client.write_all(&turn[0], length);
+          }
+          else {
+            if(!client.receive_message(received) || received.size() == 1) break;
+            client.send_message(turn);
+          }
+        }
+      });
+      message answer;
+      timing t = measure([&]{
+        if(old_way) {
+          int length = tick.size();
+          host.write_all(&length, 4);
+          host.write_all(&tick[0], length);
+          host.read_all(&length, 4);
+          answer.resize(length);
+          host.read_all(&answer[0], length);
+        }
+        else {
+          host.send_message(tick);
+          host.receive_message(answer);
+        }
+      }, 0.5);
+      // the end, as either of them reads it
+      int end = -1;
+      if(old_way) host.write_all(&end, 4);
+      else host.send_message(message(1, 0));
+      answering.join();
+      report(old_way ? "tick round trip, old writes" : "tick round trip, one write", size, t);
+    }
+  }
+}
+
+// ticks over UDP through a lossy loopback ----------------------------------------
+int udp_on_loopback(struct sockaddr_in& address) {
+  // a socket on a free port of 127.0.0.1, address says which
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t length = sizeof(address);
+  if(bind(fd, (struct sockaddr*)&address, length) == -1) error("bind");
+  getsockname(fd, (struct sockaddr*)&address, &length);
+  return fd;
+}
+
+class lossy_shim {
+  // passes packets between a client and a host, drops lost_percent of them
+  // and holds back late_percent until the next one went through
+  public:
+    lossy_shim(int host_port, int lost_percent, int late_percent);
+    ~lossy_shim(void);
+    int port;
+
+  private:
+    void run(void);
+    void pass(int from, int to, struct sockaddr_in* to_address, message& held, bool& holding);
+
+    int lost, late;
+    int client_side, host_side;
+    struct sockaddr_in client_address, host_address;
+    bool client_known;
+    prng dice;
+    atomic<bool> running;
+    thread relay;
+};
+
+lossy_shim::lossy_shim(int host_port, int lost_percent, int late_percent) : dice(3) {
+  lost = lost_percent;
+  late = late_percent;
+  client_side = udp_on_loopback(client_address);
+  port = ntohs(client_address.sin_port);
+  host_side = udp_on_loopback(host_address);
+  host_address.sin_port = htons(host_port);
+  client_known = false;
+  running = true;
+  relay = thread(&lossy_shim::run, this);
+}
+
+lossy_shim::~lossy_shim(void) {
+  running = false;
+  relay.join();
+  close(client_side);
+  close(host_side);
+}
+
+void lossy_shim::run(void) {
+  message to_host, to_client;
+  bool holding_host = false, holding_client = false;
+  while(running) {
+    struct pollfd ready[2] = {{client_side, POLLIN, 0}, {host_side, POLLIN, 0}};
+    poll(ready, 2, 10);
+    if(ready[0].revents) pass(client_side, host_side, &host_address, to_host, holding_host);
+    if(ready[1].revents) pass(host_side, client_side, client_known ? &client_address : NULL,
+                              to_client, holding_client);
+  }
+}
+
+void lossy_shim::pass(int from, int to, struct sockaddr_in* to_address, message& held, bool& holding) {
+  uint8_t packet[65536];
+  struct sockaddr_in sender;
+  socklen_t length = sizeof(sender);
+  ssize_t got = recvfrom(from, packet, sizeof(packet), 0, (struct sockaddr*)&sender, &length);
+  if(got < 0) return;
+  if(from == client_side) {
+    client_address = sender;
+    client_known = true;
+  }
+  if(!to_address || (int)dice.below(100) < lost) return;
+  if(!holding && (int)dice.below(100) < late) {
+    held.assign(packet, packet + got);
+    holding = true;
+    return;
+  }
+  sendto(to, packet, got, 0, (struct sockaddr*)to_address, sizeof(*to_address));
+  if(holding) sendto(to, held.data(), held.size(), 0, (struct sockaddr*)to_address, sizeof(*to_address));
+  holding = false;
+}
+
+void bench_udp(void) {
+  // the host sends a tick every TICK_US through network threads, as in a
+  // game, the client times when each one arrives. every tick has to arrive
+  // and in order, or the transport is no good
+  const int losses[][2] = {{0, 0}, {5, 5}, {20, 10}};
+  const int ticks = 2000, TICK_US = 1000;
+  for(int l = 0; l < 3; l++) {
+    struct sockaddr_in address;
+    // the shim mustn't get the port the host is going to have
+    int free_port = udp_on_loopback(address);
+    char host_port[6], shim_port[6], ip[20] = "127.0.0.1";
+    snprintf(host_port, sizeof(host_port), "%d", ntohs(address.sin_port));
+    lossy_shim shim(ntohs(address.sin_port), losses[l][0], losses[l][1]);
+    close(free_port);
+    snprintf(shim_port, sizeof(shim_port), "%d", shim.port);
+    // either hello may be over before the other side got ours, the network
+    // threads take over sending it again
+    network* host = NULL;
+    network_thread* sending = NULL;
+    bool greeted = false;
+    thread accepting([&]{
+      host = new server(host_port);
+      greeted = host->hello();
+      sending = new network_thread(host);
+    });
+    usleep(10000);
+    client* guest = new client(shim_port, ip, true);
+    bool greeting = guest->hello();
+    network_thread* receiving = new network_thread(guest);
+    accepting.join();
+    if(!guest->link || !host->link || !greeting || !greeted) {
+      fprintf(stderr, "udp: no connection through the shim\n");
+      exit(1);
+    }
+
+    vector<long long> latency;
+    latency.reserve(ticks);
+    bool in_order = true;
+    thread ticking([&]{
+      message tick;
+      for(int i = 0; i < ticks; i++) {
+        long long sent = chrono::duration_cast<chrono::nanoseconds>(
+                           chrono::steady_clock::now().time_since_epoch()).count();
+        int stamped[3] = {i, (int)(sent >> 32), (int)sent};
+        tick.clear();
+        append_ints(tick, stamped, 3);
+        while(!sending->send(tick)) usleep(100);
+        usleep(TICK_US);
+      }
+    });
+    message got;
+    chrono::steady_clock::time_point give_up = chrono::steady_clock::now() + chrono::seconds(30);
+    while((int)latency.size() < ticks && chrono::steady_clock::now() < give_up) {
+      if(!receiving->receive(got)) {
+        usleep(50);
+        continue;
+      }
+      long long now = chrono::duration_cast<chrono::nanoseconds>(
+                        chrono::steady_clock::now().time_since_epoch()).count();
+      int stamped[3];
+      size_t at = 0;
+      if(!read_ints(got, at, stamped, 3) || stamped[0] != (int)latency.size()) in_order = false;
+      latency.push_back(now - ((long long)stamped[1] << 32 | (uint32_t)stamped[2]));
+    }
+    ticking.join();
+    delete sending;
+    delete receiving;
+    long resent = host->link->resent;
+    int rtt = host->link->rtt_us();
+    delete host;
+    delete guest;
+
+    bool good = in_order && (int)latency.size() == ticks;
+    sort(latency.begin(), latency.end());
+    long long p50 = good ? latency[ticks / 2] : 0, p99 = good ? latency[ticks * 99 / 100] : 0;
+    long long worst = good ? latency.back() : 0;
+    if(json_output) {
+      timing t = {(double)p99, 0};
+      report_json("udp tick latency p99", 0, 0, "lost_percent", losses[l][0], t);
+    }
+    else {
+      printf("%-28s %3d%% lost %3d%% late %9.1f us p50 %9.1f us p99 %9.1f us worst "
+             "%5ld resent, rtt %d us%s\n", "udp tick latency", losses[l][0], losses[l][1],
+             p50 / 1e3, p99 / 1e3, worst / 1e3, resent, rtt, good ? "" : ", TICKS MISSING");
+    }
+    if(!good) exit(1);
+  }
+}
+
+// computer worms looking for food --------------------------------------------
+void bench_computer(void) {
+  // think() alone, timed tick by tick between simulated ticks. the worst
+  // tick is what has to fit into the tick budget. the first tick of a round
+  // also makes room for the round, it's counted on its own
+  const int sizes[][2] = {{100, 100}, {500, 500}, {1000, 1000}};
+  const int counts[] = {1, 4};
+  const long ticks = 20000;
+  for(int s = 0; s < 3; s++) {
+    int width = sizes[s][0], height = sizes[s][1];
+    for(int c = 0; c < 2; c++) {
+      computer_players = counts[c];
+      bench_round(width, height, counts[c]);
+      double total = 0, worst = 0, starting = 0;
+      long allocated = 0, starting_allocated = 0, rounds = 0;
+      bool first_tick = true;
+      for(long tick = 0; tick < ticks; tick++) {
+        long before = allocations;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        think();
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        if(first_tick) {
+          starting += elapsed.count();
+          starting_allocated += allocations - before;
+          rounds++;
+          first_tick = false;
+        }
+        else {
+          allocated += allocations - before;
+          total += elapsed.count();
+          if(elapsed.count() > worst) worst = elapsed.count();
+        }
+        simulate();
+        if(gamestate==stopping) {
+          bench_round(width, height, counts[c]);
+          first_tick = true;
+        }
+      }
+      long later_ticks = ticks - rounds;
+      timing average = {total * 1e9 / later_ticks, (double)allocated / later_ticks};
+      timing worst_tick = {worst * 1e9, average.allocs};
+      timing round_start = {starting * 1e9 / rounds, (double)starting_allocated / rounds};
+      report_board("computer think", width, height, average, "worms", counts[c]);
+      report_board("computer think, worst tick", width, height, worst_tick, "worms", counts[c]);
+      report_board("computer think, round start", width, height, round_start, "worms", counts[c]);
+    }
+  }
+  computer_players = 0;
+  food.clear();
+  clear_players();
+}
+
+// hundreds of worms on a big board ---------------------------------------------
+void bench_arena(void) {
+  // the same ticks with more and more threads, worms turning at random. the
+  // state has to come out the same every time, or the threads are no good
+  const int sizes[][3] = {{1000, 1000, 500}, {4000, 4000, 1000}};
+  const long ticks = 2000;
+  int most = max(2, (int)thread::hardware_concurrency());
+  for(int s = 0; s < 2; s++) {
+    int width = sizes[s][0], height = sizes[s][1], worms = sizes[s][2];
+    double one_thread = 0;
+    unsigned long long expected = 0;
+    for(int threads = 1; ; threads = min(threads * 2, most)) {
+      tick_threads = threads;
+      bench_round(width, height, worms);
+      prng steering(1);
+      long allocated = allocations;
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      for(long tick = 0; tick < ticks; tick++) {
+        for(size_t i = 0; i < players.size(); i++) {
+          if(steering.below(8)) continue;
+          int turn = steering.below(2) ? 1 : -1;
+          direction next = {0, turn};
+          if(!players[i]->move_x) {
+            next.x = turn;
+            next.y = 0;
+          }
+          commands[i].push(next);
+        }
+        simulate();
+        if(gamestate==stopping) {
+          new_round();
+          gamestate = running;
+        }
+      }
+      chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+      timing t = {elapsed.count() * 1e9 / ticks, (double)(allocations - allocated) / ticks};
+      if(threads == 1) {
+        one_thread = t.ns;
+        expected = state_hash();
+      }
+      bool same = (state_hash() == expected);
+      if(json_output) report_json("arena tick", width, height, "threads", threads, t);
+      else {
+        printf("%-28s %5dx%-5d %12.1f ns/tick %8.2f allocs/tick %4d worms %3d threads %9.0f ticks/s %5.2fx%s\n",
+               "arena tick", width, height, t.ns, t.allocs, worms, threads, 1e9 / t.ns,
+               one_thread / t.ns, same ? "" : ", NOT THE SAME STATE");
+      }
+      if(!same) exit(1);
+      if(threads == most) break;
+    }
+  }
+  tick_threads = 1;
+  food.clear();
+  clear_players();
+}
+
+// a game with hundreds watching --------------------------------------------
+int tcp_free_port(void) {
+  int fds[2];
+  tcp_loopback(fds);
+  struct sockaddr_in address;
+  socklen_t length = sizeof(address);
+  getsockname(fds[1], (struct sockaddr*)&address, &length);
+  close(fds[0]);
+  close(fds[1]);
+  return ntohs(address.sin_port);
+}
+
+int connect_viewer(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = htons(port);
+  if(connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1) error("connect");
+  int hello[3] = {8, PROTOCOL_MAGIC, PROTOCOL_VERSION};
+  uint8_t bytes[12];
+  put_ints(bytes, hello, 3);
+  if(write(fd, bytes, sizeof(bytes)) != (ssize_t)sizeof(bytes)) error("write");
+  return fd;
+}
+
+bool watch_frames(message& stream, bool& welcomed, grid& watched, atomic<int>& round) {
+  // apply what's complete of the stream after the 28 bytes of hello and
+  // welcome to watched, false if a frame is broken. round is the last one seen
+  size_t used = 0;
+  if(!welcomed) {
+    if(stream.size() < 28) return true;
+    used = 28;
+    welcomed = true;
+  }
+  while(stream.size() - used >= 4) {
+    int length = get_int(&stream[used]);
+    if(stream.size() - used - 4 < (size_t)length) break;
+    size_t at = used + 4;
+    used += 4 + length;
+    if(!length) continue;
+    int header[5];
+    if(!read_ints(stream, at, header, 5)) return false;
+    if(header[3] != watched.width || header[4] != watched.height) watched.resize(header[3], header[4]);
+    if(!apply_playground(watched, stream, at)) return false;
+    round = header[0];
+  }
+  stream.erase(stream.begin(), stream.begin() + used);
+  return true;
+}
+
+void bench_spectate(void) {
+  // ticks of an arena as in bench_arena, as fast as a game goes and
+  // published to more and more viewers over loopback. only the ticks are
+  // timed, the viewers get the time between them as in a game. a quarter of
+  // them never read. one of the others follows the playground, which has to
+  // come out the same
+  const int sizes[][3] = {{200, 50, 2}, {1000, 1000, 100}};
+  const int counts[] = {0, 100, 200};
+  const long ticks = 500;
+  for(int s = 0; s < 2; s++) {
+    int width = sizes[s][0], height = sizes[s][1], worms = sizes[s][2];
+    double nobody = 0;
+    for(int c = 0; c < 3; c++) {
+      int count = counts[c];
+      bench_round(width, height, worms);
+      char port[6];
+      int number = tcp_free_port();
+      snprintf(port, sizeof(port), "%d", number);
+      audience = new spectators(port);
+      vector<int> fast, slow;
+      for(int i = 0; i < count; i++) {
+        int fd = connect_viewer(number);
+        if(i % 4 == 3) slow.push_back(fd);
+        else fast.push_back(fd);
+      }
+      while(audience->watching() < count) usleep(1000);
+
+      atomic<bool> done(false);
+      atomic<long> received(0);
+      atomic<int> watched_round(0);
+      grid watched;
+      bool same_stream = true;
+      thread reading([&]{
+        vector<struct pollfd> ready(fast.size());
+        message stream;
+        bool welcomed = false;
+        uint8_t buffer[65536];
+        while(!done && !fast.empty()) {
+          for(size_t i = 0; i < fast.size(); i++) {
+            ready[i].fd = fast[i];
+            ready[i].events = POLLIN;
+          }
+          if(poll(&ready[0], ready.size(), 10) <= 0) continue;
+          for(size_t i = 0; i < fast.size(); i++) {
+            if(!ready[i].revents) continue;
+            ssize_t got;
+            while((got = recv(fast[i], buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) {
+              received += got;
+              if(i) continue;
+              stream.insert(stream.end(), buffer, buffer + got);
+              if(!watch_frames(stream, welcomed, watched, watched_round)) same_stream = false;
+            }
+          }
+        }
+      });
+
+      prng steering(1);
+      vector<long long> took;
+      took.reserve(ticks);
+      long allocated = allocations;
+      chrono::steady_clock::time_point next = chrono::steady_clock::now();
+      for(long tick = 0; tick < ticks; tick++) {
+        this_thread::sleep_until(next);
+        next += chrono::milliseconds(MIN_TICK_MS);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for(size_t i = 0; i < players.size(); i++) {
+          if(steering.below(8)) continue;
+          int turn = steering.below(2) ? 1 : -1;
+          direction next = {0, turn};
+          if(!players[i]->move_x) {
+            next.x = turn;
+            next.y = 0;
+          }
+          commands[i].push(next);
+        }
+        simulate();
+        if(gamestate==stopping) {
+          new_round();
+          gamestate = running;
+        }
+        audience->publish(rounds_started, false);
+        took.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+      }
+      long long total = 0;
+      for(long i = 0; i < ticks; i++) total += took[i];
+      timing t = {(double)total / ticks, (double)(allocations - allocated) / ticks};
+      sort(took.begin(), took.end());
+      long long p99 = took[ticks * 99 / 100];
+      if(!count) nobody = t.ns;
+
+      // a last keyframe in a round of its own, until the watching viewer has
+      // it. then it has to be where we are
+      if(count) {
+        // again now and then, in case there was no room for it. it takes a
+        // while to go out to all of them
+        for(int waited = 0; waited < 60000 && watched_round != -1; waited += 10) {
+          if(waited % 2000 == 0) audience->publish(-1, true);
+          usleep(10000);
+        }
+      }
+      done = true;
+      reading.join();
+      bool same = !count || (same_stream && watched.size() == playground.size() &&
+                  !memcmp(watched.cells, playground.cells, playground.size() * sizeof(cellvalue)));
+      delete audience;
+      audience = NULL;
+      for(size_t i = 0; i < fast.size(); i++) close(fast[i]);
+      for(size_t i = 0; i < slow.size(); i++) close(slow[i]);
+
+      if(json_output) report_json("tick + publish", width, height, "viewers", count, t);
+      else {
+        // what the viewers add, against the shortest tick a game has
+        double added = t.ns - nobody;
+        printf("%-28s %5dx%-5d %12.1f ns/tick %8.2f allocs/tick %9.1f us p99 %4d viewers "
+               "%+9.1f us = %5.2f%% of a tick %8.1f MB read%s\n", "tick + publish", width, height,
+               t.ns, t.allocs, p99 / 1e3, count, added / 1e3, added / (MIN_TICK_MS * 1e4),
+               received / 1e6, same ? "" : ", NOT THE SAME PLAYGROUND");
+      }
+      if(!same) exit(1);
+    }
+  }
+  food.clear();
+  clear_players();
+}
+
+// frames for the terminal, through ncurses and as escape sequences -----------
+struct frame_cost {
+  double cpu_ns, bytes, allocs;
+};
+
+double thread_cpu_ns(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec * 1e9 + now.tv_nsec;
+}
+
+frame_cost render_frames(renderer& screen, WINDOW* window, FILE* out, int frames, bool everything) {
+  // ticks of worms turning at random, each drawn as the game would. only
+  // drawing counts, the bytes are what came out in the file
+  prng steering(2);
+  double cpu = 0;
+  long allocated = 0;
+  struct stat before, after;
+  fflush(out);
+  fstat(fileno(out), &before);
+  for(int frame = 0; frame < frames; frame++) {
+    for(size_t i = 0; i < players.size(); i++) {
+      if(steering.below(6)) continue;
+      int turn = steering.below(2) ? 1 : -1;
+      direction next = {0, turn};
+      if(!players[i]->move_x) {
+        next.x = turn;
+        next.y = 0;
+      }
+      commands[i].push(next);
+    }
+    simulate();
+    if(gamestate==stopping) {
+      new_round();
+      gamestate = running;
+    }
+    double start = thread_cpu_ns();
+    long allocated_before = allocations;
+    screen.draw(window, everything);
+    allocated += allocations - allocated_before;
+    cpu += thread_cpu_ns() - start;
+    playground.forget_changes();
+  }
+  fflush(out);
+  fstat(fileno(out), &after);
+  frame_cost cost = {cpu / frames, (double)(after.st_size - before.st_size) / frames,
+                     (double)allocated / frames};
+  return cost;
+}
+
+void bench_render(void) {
+  // a terminal of 200x60 and one of 400x120 filled with the playground, as
+  // in singleplayer, and a board of 2000x2000 seen through the camera of
+  // the small one. the same frames go through both renderers into a file
+  // that stands in for the terminal
+  const int terminals[][5] = {{200, 60, 2}, {200, 60, 50}, {400, 120, 2}, {400, 120, 200},
+                              {200, 60, 200, 2000, 2000}};
+  const char* names[2] = {"curses", "ansi"};
+  setenv("TERM", "xterm", 1);
+  for(int t = 0; t < 5; t++) {
+    int columns = terminals[t][0], lines = terminals[t][1], worms = terminals[t][2];
+    bool camera = terminals[t][3] > 0;
+    for(int backend = 0; backend < 2; backend++) {
+      FILE* out = tmpfile();
+      FILE* in = fopen("/dev/null", "r");
+      SCREEN* terminal = newterm(NULL, out, in);
+      set_term(terminal);
+      resizeterm(lines, columns);
+      start_color();
+      init_colour_pairs();
+      bkgd(COLOR_PAIR(9));
+      renderer* screen = backend ? (renderer*)new ansi_renderer(fileno(out)) : new curses_renderer;
+      play_x = camera ? terminals[t][3] : (columns-10)/2;
+      play_y = camera ? terminals[t][4] : lines-10;
+      WINDOW* window = newwin(std::min(play_y, lines-10), std::min(play_x*2, columns-10), 5, 5);
+      level = 3;
+      background_pair = 9;
+      wbkgd(window, COLOR_PAIR(background_pair));
+      gamemode = local_multi;
+      player_count = worms;
+      food_count = 30;
+      match_random.seed(1);
+      new_round();
+      gamestate = running;
+      // the camera on the first worm, as the game has it at the start
+      const wormpiece& head = player1->body.head();
+      screen->view_x = std::max(0, std::min(head.pos_x-1 - getmaxx(window)/4, play_x - getmaxx(window)/2));
+      screen->view_y = std::max(0, std::min(head.pos_y-1 - getmaxy(window)/2, play_y - getmaxy(window)));
+
+      frame_cost full = render_frames(*screen, window, out, 20, true);
+      frame_cost tick = render_frames(*screen, window, out, 500, false);
+      const char* kinds[2] = {"full", "tick"};
+      frame_cost costs[2] = {full, tick};
+      for(int k = 0; k < 2; k++) {
+        char name[64];
+        snprintf(name, sizeof(name), "render %s %s", kinds[k], names[backend]);
+        if(camera) snprintf(name + strlen(name), sizeof(name) - strlen(name), " %dx%d", play_x, play_y);
+        if(json_output) {
+          timing cpu = {costs[k].cpu_ns, costs[k].allocs};
+          report_json(name, columns, lines, "worms", worms, cpu, "bytes_per_frame", costs[k].bytes);
+        }
+        else {
+          printf("%-28s %5dx%-5d %12.1f ns/frame %8.2f allocs/frame %8.0f bytes/frame %4d worms\n",
+                 name, columns, lines, costs[k].cpu_ns, costs[k].allocs, costs[k].bytes, worms);
+        }
+      }
+      delete screen;
+      delwin(window);
+      endwin();
+      delscreen(terminal);
+      fclose(out);
+      fclose(in);
+    }
+  }
+  food_count = 3;
+  food.clear();
+  clear_players();
+}
+
+// turns from a keyboard thread while rounds restart --------------------------
+// the keyboard thread only ever pushes to the command queues while the game
+// thread ticks and replaces the players. "make tsan" runs this under
+// ThreadSanitizer, which complains about any other sharing
+void bench_input(void) {
+  gamemode = local_multi;
+  player_count = 2;
+  play_x = 80;
+  play_y = 40;
+  level = 0;
+  match_random.seed(1);
+  new_round();
+  gamestate = running;
+
+  atomic<bool> done(false);
+  long pushed = 0, dropped = 0;
+  thread keys([&]{
+    prng keyboard(2);
+    while(!done) {
+      int number = keyboard.below(2) + 1;
+      int step = keyboard.below(2) ? 1 : -1;
+      direction turn = {0, step};
+      if(keyboard.below(2)) {
+        turn.x = step;
+        turn.y = 0;
+      }
+      if(commands[number-1].push(turn)) pushed++;
+      else dropped++;
+    }
+  });
+
+  const long ticks = 200000;
+  long rounds = 1;
+  timing t = measure([&]{
+    for(long tick = 0; tick < ticks; tick++) {
+      simulate();
+      if(gamestate==stopping || tick % 500 == 0) {
+        new_round();
+        gamestate = running;
+        rounds++;
+      }
+    }
+  }, 0.5);
+  done = true;
+  keys.join();
+  t.ns /= ticks;
+  t.allocs /= ticks;
+  if(json_output) report_json("tick with turns hammered", 0, 0, "ticks", ticks, t);
+  else {
+    printf("%-28s %7ld ticks %12.1f ns/tick %ld rounds, %ld turns queued, %ld dropped\n",
+           "tick with turns hammered", ticks, t.ns, rounds, pushed, dropped);
+  }
+  food.clear();
+  clear_players();
+}
+
+//-----------------------------------------------------------------------------
+bool wanted(int argc, char** argv, const char* name) {
+  // no names means all of them, options aren't names
+  bool any = false;
+  for(int i = 1; i < argc; i++) {
+    if(argv[i][0] == '-') continue;
+    if(!strcmp(argv[i], name)) return true;
+    any = true;
+  }
+  return !any;
+}
+
+int main(int argc, char** argv) {
+  for(int i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "--json")) json_output = true;
+  }
+  if(wanted(argc, argv, "wormbody")) bench_wormbody();
+  if(wanted(argc, argv, "grid")) bench_grid();
+  if(wanted(argc, argv, "bitboard")) bench_bitboard();
+  if(wanted(argc, argv, "level")) bench_level();
+  if(wanted(argc, argv, "food")) bench_food();
+  if(wanted(argc, argv, "input")) bench_input();
+  if(wanted(argc, argv, "tick")) bench_tick();
+  if(wanted(argc, argv, "sync")) bench_sync();
+  if(wanted(argc, argv, "wire")) bench_wire();
+  if(wanted(argc, argv, "udp")) bench_udp();
+  if(wanted(argc, argv, "spectate")) bench_spectate();
+  if(wanted(argc, argv, "computer")) bench_computer();
+  if(wanted(argc, argv, "render")) bench_render();
+  if(wanted(argc, argv, "arena")) bench_arena();
+  if(json_output) printf("%s\n", json_results ? "\n]" : "[]");
+  return 0;
+}
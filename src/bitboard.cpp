@@ -0,0 +1,312 @@
+// a bit per cell of the playground, for whole-board questions that the
+// cells would answer one at a time: what's in the way, how much is free,
+// what can be reached from here. every row starts a new 64-bit word, bit x
+// of a row is column x+1, the bits after the last column stay 0.
+//
+// the passes over all words go 4 at a time with AVX2 or 2 with SSE2 where
+// the CPU has them, one at a time otherwise. bitboard_simd says which.
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WORM_X86 1
+#endif
+
+enum simd_levels {simd_scalar, simd_sse2, simd_avx2};
+const char* SIMD_NAMES[3] = {"scalar", "sse2", "avx2"};
+
+simd_levels best_simd(void) {
+#ifdef WORM_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) return simd_avx2;
+  if(__builtin_cpu_supports("sse2")) return simd_sse2;
+#endif
+  return simd_scalar;
+}
+
+simd_levels bitboard_simd = best_simd(); // worm-bench goes lower to compare
+
+// the passes, one for each level --------------------------------------------
+// or_words: out = a | b
+// count_words: the bits that are set
+// spread_words: out |= (a | b) & mask, true if that changed out
+
+void or_words_scalar(uint64_t* out, const uint64_t* a, const uint64_t* b, size_t n) {
+  for(size_t i = 0; i < n; i++) out[i] = a[i] | b[i];
+}
+
+long count_words_scalar(const uint64_t* a, size_t n) {
+  long count = 0;
+  for(size_t i = 0; i < n; i++) count += __builtin_popcountll(a[i]);
+  return count;
+}
+
+bool spread_words_scalar(uint64_t* out, const uint64_t* a, const uint64_t* b,
+                         const uint64_t* mask, size_t n) {
+  uint64_t changed = 0;
+  for(size_t i = 0; i < n; i++) {
+    uint64_t more = (a[i] | b[i]) & mask[i] & ~out[i];
+    out[i] |= more;
+    changed |= more;
+  }
+  return changed != 0;
+}
+
+#ifdef WORM_X86
+__attribute__((target("sse2")))
+void or_words_sse2(uint64_t* out, const uint64_t* a, const uint64_t* b, size_t n) {
+  size_t i = 0;
+  for(; i + 2 <= n; i += 2) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+    __m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_or_si128(x, y));
+  }
+  or_words_scalar(out + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("sse2")))
+long count_words_sse2(const uint64_t* a, size_t n) {
+  // the bit trick in both halves, psadbw adds up the bytes
+  const __m128i m1 = _mm_set1_epi8(0x55), m2 = _mm_set1_epi8(0x33), m4 = _mm_set1_epi8(0x0f);
+  __m128i sum = _mm_setzero_si128();
+  size_t i = 0;
+  for(; i + 2 <= n; i += 2) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+    x = _mm_sub_epi8(x, _mm_and_si128(_mm_srli_epi64(x, 1), m1));
+    x = _mm_add_epi8(_mm_and_si128(x, m2), _mm_and_si128(_mm_srli_epi64(x, 2), m2));
+    x = _mm_and_si128(_mm_add_epi8(x, _mm_srli_epi64(x, 4)), m4);
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(x, _mm_setzero_si128()));
+  }
+  uint64_t halves[2];
+  _mm_storeu_si128((__m128i*)halves, sum);
+  return (long)(halves[0] + halves[1]) + count_words_scalar(a + i, n - i);
+}
+
+__attribute__((target("sse2")))
+bool spread_words_sse2(uint64_t* out, const uint64_t* a, const uint64_t* b,
+                       const uint64_t* mask, size_t n) {
+  __m128i changed = _mm_setzero_si128();
+  size_t i = 0;
+  for(; i + 2 <= n; i += 2) {
+    __m128i before = _mm_loadu_si128((const __m128i*)(out + i));
+    __m128i from = _mm_or_si128(_mm_loadu_si128((const __m128i*)(a + i)),
+                                _mm_loadu_si128((const __m128i*)(b + i)));
+    __m128i more = _mm_andnot_si128(before, _mm_and_si128(from, _mm_loadu_si128((const __m128i*)(mask + i))));
+    _mm_storeu_si128((__m128i*)(out + i), _mm_or_si128(before, more));
+    changed = _mm_or_si128(changed, more);
+  }
+  bool rest = spread_words_scalar(out + i, a + i, b + i, mask + i, n - i);
+  return rest || _mm_movemask_epi8(_mm_cmpeq_epi8(changed, _mm_setzero_si128())) != 0xffff;
+}
+
+__attribute__((target("avx2")))
+void or_words_avx2(uint64_t* out, const uint64_t* a, const uint64_t* b, size_t n) {
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+    __m256i y = _mm256_loadu_si256((const __m256i*)(b + i));
+    _mm256_storeu_si256((__m256i*)(out + i), _mm256_or_si256(x, y));
+  }
+  or_words_scalar(out + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+long count_words_avx2(const uint64_t* a, size_t n) {
+  // a table lookup per nibble with vpshufb, vpsadbw adds up the bytes
+  const __m256i table = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low = _mm256_set1_epi8(0x0f);
+  __m256i sum = _mm256_setzero_si256();
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(a + i));
+    __m256i bits = _mm256_add_epi8(_mm256_shuffle_epi8(table, _mm256_and_si256(x, low)),
+                                   _mm256_shuffle_epi8(table, _mm256_and_si256(_mm256_srli_epi16(x, 4), low)));
+    sum = _mm256_add_epi64(sum, _mm256_sad_epu8(bits, _mm256_setzero_si256()));
+  }
+  uint64_t quarters[4];
+  _mm256_storeu_si256((__m256i*)quarters, sum);
+  return (long)(quarters[0] + quarters[1] + quarters[2] + quarters[3]) + count_words_scalar(a + i, n - i);
+}
+
+__attribute__((target("avx2")))
+bool spread_words_avx2(uint64_t* out, const uint64_t* a, const uint64_t* b,
+                       const uint64_t* mask, size_t n) {
+  __m256i changed = _mm256_setzero_si256();
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4) {
+    __m256i before = _mm256_loadu_si256((const __m256i*)(out + i));
+    __m256i from = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(a + i)),
+                                   _mm256_loadu_si256((const __m256i*)(b + i)));
+    __m256i more = _mm256_andnot_si256(before, _mm256_and_si256(from, _mm256_loadu_si256((const __m256i*)(mask + i))));
+    _mm256_storeu_si256((__m256i*)(out + i), _mm256_or_si256(before, more));
+    changed = _mm256_or_si256(changed, more);
+  }
+  bool rest = spread_words_scalar(out + i, a + i, b + i, mask + i, n - i);
+  return rest || !_mm256_testz_si256(changed, changed);
+}
+#endif
+
+void or_words(uint64_t* out, const uint64_t* a, const uint64_t* b, size_t n) {
+#ifdef WORM_X86
+  if(bitboard_simd == simd_avx2) return or_words_avx2(out, a, b, n);
+  if(bitboard_simd == simd_sse2) return or_words_sse2(out, a, b, n);
+#endif
+  or_words_scalar(out, a, b, n);
+}
+
+long count_words(const uint64_t* a, size_t n) {
+#ifdef WORM_X86
+  if(bitboard_simd == simd_avx2) return count_words_avx2(a, n);
+  if(bitboard_simd == simd_sse2) return count_words_sse2(a, n);
+#endif
+  return count_words_scalar(a, n);
+}
+
+bool spread_words(uint64_t* out, const uint64_t* a, const uint64_t* b,
+                  const uint64_t* mask, size_t n) {
+#ifdef WORM_X86
+  if(bitboard_simd == simd_avx2) return spread_words_avx2(out, a, b, mask, n);
+  if(bitboard_simd == simd_sse2) return spread_words_sse2(out, a, b, mask, n);
+#endif
+  return spread_words_scalar(out, a, b, mask, n);
+}
+
+// along a row, as far as mask lets through -----------------------------------
+// the occluded fill of chess engines: six shifts instead of one per column
+inline uint64_t fill_up(uint64_t bits, uint64_t mask) {
+  bits &= mask;
+  bits |= mask & (bits << 1);  mask &= mask << 1;
+  bits |= mask & (bits << 2);  mask &= mask << 2;
+  bits |= mask & (bits << 4);  mask &= mask << 4;
+  bits |= mask & (bits << 8);  mask &= mask << 8;
+  bits |= mask & (bits << 16); mask &= mask << 16;
+  return bits | (mask & (bits << 32));
+}
+
+inline uint64_t fill_down(uint64_t bits, uint64_t mask) {
+  bits &= mask;
+  bits |= mask & (bits >> 1);  mask &= mask >> 1;
+  bits |= mask & (bits >> 2);  mask &= mask >> 2;
+  bits |= mask & (bits >> 4);  mask &= mask >> 4;
+  bits |= mask & (bits >> 8);  mask &= mask >> 8;
+  bits |= mask & (bits >> 16); mask &= mask >> 16;
+  return bits | (mask & (bits >> 32));
+}
+
+// the board ------------------------------------------------------------------
+class bitboard {
+  public:
+    bitboard(void) : width(0), height(0), row_words(0) {}
+    void resize(int width, int height);
+    void clear(void) {memset(words.data(), 0, words.size() * sizeof(uint64_t));}
+    void copy(const bitboard& from);
+    // pos as grid::index() has it
+    void set(int pos) {words[word_of(pos)] |= bit_of(pos);}
+    void reset(int pos) {words[word_of(pos)] &= ~bit_of(pos);}
+    bool test(int pos) const {return (words[word_of(pos)] & bit_of(pos)) != 0;}
+    void unite(const bitboard& a, const bitboard& b);
+    long count(void) const {return count_words(words.data(), words.size());}
+    // the cells reached from the start cells in here without going through
+    // blocked, over the edges of the board like the worms go
+    void flood(const bitboard& blocked);
+
+    int width, height;
+
+  private:
+    int word_of(int pos) const {return pos / width * row_words + pos % width / 64;}
+    uint64_t bit_of(int pos) const {return (uint64_t)1 << (pos % width % 64);}
+    void fill_row(uint64_t* row, const uint64_t* open);
+
+    int row_words;
+    std::vector<uint64_t> words;
+    std::vector<uint64_t> open; // for flood(), what isn't blocked
+    std::vector<uint8_t> dirty; // and the rows next to one that changed
+};
+
+void bitboard::resize(int width, int height) {
+  this->width = width;
+  this->height = height;
+  row_words = (width + 63) / 64;
+  words.assign((size_t)row_words * height, 0);
+}
+
+void bitboard::copy(const bitboard& from) {
+  // the same size as this one
+  memcpy(words.data(), from.words.data(), words.size() * sizeof(uint64_t));
+}
+
+void bitboard::unite(const bitboard& a, const bitboard& b) {
+  // the same size as both
+  or_words(words.data(), a.words.data(), b.words.data(), words.size());
+}
+
+void bitboard::fill_row(uint64_t* row, const uint64_t* open) {
+  // spread the bits of a row along it, over both ends
+  int last = width - 1;
+  uint64_t& first = row[0];
+  uint64_t& end = row[last / 64];
+  uint64_t first_bit = 1, last_bit = (uint64_t)1 << (last % 64);
+  bool wraps = true;
+  while(wraps) {
+    uint64_t carry = 0;
+    for(int w = 0; w < row_words; w++) {
+      row[w] = fill_up(row[w] | (carry & open[w]), open[w]);
+      carry = row[w] >> 63;
+    }
+    carry = 0;
+    for(int w = row_words - 1; w >= 0; w--) {
+      row[w] = fill_down(row[w] | ((carry << 63) & open[w]), open[w]);
+      carry = row[w] & 1;
+    }
+    wraps = false;
+    if((end & last_bit) && (open[0] & first_bit) && !(first & first_bit)) {
+      first |= first_bit;
+      wraps = true;
+    }
+    if((first & first_bit) && (open[last / 64] & last_bit) && !(end & last_bit)) {
+      end |= last_bit;
+      wraps = true;
+    }
+  }
+}
+
+void bitboard::flood(const bitboard& blocked) {
+  // down the rows and back up until nothing changes. a row takes from the
+  // ones above and below, then spreads along itself. only rows next to one
+  // that changed are looked at again
+  open.resize(words.size());
+  dirty.assign(height, 1);
+  uint64_t tail = (width % 64) ? ((uint64_t)1 << (width % 64)) - 1 : ~(uint64_t)0;
+  for(int y = 0; y < height; y++) {
+    for(int w = 0; w < row_words; w++) {
+      size_t i = (size_t)y * row_words + w;
+      open[i] = ~blocked.words[i] & (w == row_words - 1 ? tail : ~(uint64_t)0);
+      words[i] &= open[i];
+    }
+    fill_row(&words[(size_t)y * row_words], &open[(size_t)y * row_words]);
+  }
+  bool changed = true;
+  while(changed) {
+    changed = false;
+    for(int pass = 0; pass < 2; pass++) {
+      for(int i = 0; i < height; i++) {
+        int y = pass ? height - 1 - i : i;
+        if(!dirty[y]) continue;
+        dirty[y] = 0;
+        int up = (y + height - 1) % height, down = (y + 1) % height;
+        uint64_t* row = &words[(size_t)y * row_words];
+        const uint64_t* row_open = &open[(size_t)y * row_words];
+        if(spread_words(row, &words[(size_t)up * row_words], &words[(size_t)down * row_words],
+                        row_open, row_words)) {
+          fill_row(row, row_open);
+          dirty[up] = dirty[down] = 1;
+          changed = true;
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,5 @@
+#ifndef WORM_BITBOARD_H
+#define WORM_BITBOARD_H
+class bitboard;
+#include "bitboard.cpp"
+#endif
@@ -0,0 +1,434 @@
+// worms steered by the computer. each heads for the food closest to it along
+// a path A* finds on the playground, around walls and worms. when there was
+// no way to it, a flood fill of the bitboards tells which food can be got to
+// at all before the next search. one search runs at a time and gets a
+// budget of cells per tick, shared by all computer worms, so a big board
+// costs more ticks rather than a longer tick. worms without a path meanwhile
+// go wherever is free, straight on mostly, so a search starts where the worm
+// will be when it's done. nothing here is random or timed, the same round
+// always plays the same.
+
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+#include "game.h"
+#include "bitboard.h"
+
+const int THINKING_BUDGET = 20000; // cells looked at per tick, all worms together
+const int REST_TICKS = 10;         // before looking again when no way was found
+
+int computer_players = 0;          // the last this many players are computer worms
+
+int steps_between(int a, int b) {
+  // on an empty playground, going over the edges included
+  int width = playground.width, height = playground.height;
+  int dx = abs(a % width - b % width), dy = abs(a / width - b / width);
+  if(dx > width - dx) dx = width - dx;
+  if(dy > height - dy) dy = height - dy;
+  return dx + dy;
+}
+
+void neighbours_of(int pos, int* around) {
+  // right, left, down and up, over the edges like move() goes
+  int width = playground.width, height = playground.height;
+  int x = pos % width, y = pos / width;
+  around[0] = y * width + (x + 1) % width;
+  around[1] = y * width + (x + width - 1) % width;
+  around[2] = ((y + 1) % height) * width + x;
+  around[3] = ((y + height - 1) % height) * width + x;
+}
+
+// A* on the playground -------------------------------------------------------
+// steps cost the same and the heuristic is the distance on a board that
+// wraps around, so f only grows by 0 or 2 from one node to the next. two
+// stacks do the job of a priority queue then: one for the f being looked
+// at, one for f + 2
+class pathfinder {
+  public:
+    pathfinder(void);
+    void prepare(void);        // for the playground as it is now
+    void start(int from, int to);
+    bool search(int& budget);  // true when done, found tells how
+    void path(std::vector<int>& out) const; // from start to target
+
+    bool found;
+    int from, to;
+
+  private:
+    bool blocked(int pos) const;
+
+    int size, width, height;
+    unsigned int generation;   // seen and closed are only valid if equal
+    std::vector<unsigned int> seen, closed;
+    std::vector<int> cost;     // steps from the start
+    std::vector<int> parent;
+    std::vector<int> now, later; // the open cells at f and at f + 2
+    int f;
+    bool running;
+};
+
+pathfinder::pathfinder(void) {
+  size = width = height = 0;
+  generation = 0;
+  found = false;
+  running = false;
+  from = to = -1;
+}
+
+void pathfinder::prepare(void) {
+  // buffers for the board as it is now, kept as long as it stays that big.
+  // every cell is pushed at most twice, once at f + 2 and once at f
+  width = playground.width;
+  height = playground.height;
+  if(size == playground.size()) return;
+  size = playground.size();
+  seen.assign(size, 0);
+  closed.assign(size, 0);
+  cost.assign(size, 0);
+  parent.assign(size, -1);
+  now.clear();
+  later.clear();
+  now.reserve(2 * size);
+  later.reserve(2 * size);
+  generation = 0;
+}
+
+bool pathfinder::blocked(int pos) const {
+  int kind = cell_kind(playground[pos]);
+  return kind == WALL || kind == WORM || kind == WORMHEAD;
+}
+
+void pathfinder::start(int from, int to) {
+  prepare();
+  if(++generation == 0) {
+    // once in four billion searches the stamps start over
+    seen.assign(size, 0);
+    closed.assign(size, 0);
+    generation = 1;
+  }
+  this->from = from;
+  this->to = to;
+  now.clear();
+  later.clear();
+  seen[from] = generation;
+  cost[from] = 0;
+  parent[from] = -1;
+  f = steps_between(from, to);
+  now.push_back(from);
+  found = false;
+  running = true;
+}
+
+bool pathfinder::search(int& budget) {
+  while(running && budget > 0) {
+    if(now.empty()) {
+      if(later.empty()) {
+        running = false; // no way there
+        break;
+      }
+      now.swap(later);
+      f += 2;
+    }
+    int pos = now.back();
+    now.pop_back();
+    if(closed[pos] == generation) continue; // pushed again with a lower cost
+    closed[pos] = generation;
+    budget--;
+    if(pos == to) {
+      found = true;
+      running = false;
+      break;
+    }
+    int neighbours[4];
+    neighbours_of(pos, neighbours);
+    for(int n = 0; n < 4; n++) {
+      int next = neighbours[n];
+      if(next != to && blocked(next)) continue;
+      int next_cost = cost[pos] + 1;
+      if(seen[next] == generation && cost[next] <= next_cost) continue;
+      seen[next] = generation;
+      cost[next] = next_cost;
+      parent[next] = pos;
+      if(next_cost + steps_between(next, to) == f) now.push_back(next);
+      else later.push_back(next);
+    }
+  }
+  return !running;
+}
+
+void pathfinder::path(std::vector<int>& out) const {
+  out.clear();
+  if(!found) return;
+  for(int pos = to; pos != -1; pos = parent[pos]) out.push_back(pos);
+  // it was collected backwards
+  for(size_t i = 0, j = out.size() - 1; i < j; i++, j--) {
+    int swapped = out[i];
+    out[i] = out[j];
+    out[j] = swapped;
+  }
+}
+
+// the worms ------------------------------------------------------------------
+class computer {
+  public:
+    computer(int number);
+    bool on_track(void) const;
+    int next_cell(void) const {return path[at + 1];}
+    int head(void) const;
+    direction free_way(void) const;
+    int ahead(int from, int steps, int& count) const;
+    bool join_path(void);
+
+    int number;
+    std::vector<int> path;     // cells from where the plan was made to food
+    size_t at;                 // where in path the head should be
+    int resting;               // ticks until looking for a way again
+    bool walled_in;            // the last search found no way
+    int planned_ahead;         // cells straight on from the head the search started at
+    long started;              // the tick of think() the search started in
+};
+
+std::vector<computer> computers;
+int planned_round = -1;             // rounds_started when the computers were made
+pathfinder finder;
+int searching = -1;                 // the computer finder works for, or -1
+size_t next_computer = 0;           // the one to look for a way next
+long thinking_ticks = 0;            // calls of think(), a tick each
+int search_ticks = 0;               // how long the last search took
+std::vector<int> food_cells;
+bitboard in_the_way, reachable;
+
+computer::computer(int number) {
+  this->number = number;
+  at = 0;
+  resting = 0;
+  walled_in = false;
+  planned_ahead = 0;
+  started = 0;
+}
+
+int computer::head(void) const {
+  wormpiece& piece = players[number-1]->body.head();
+  return playground.index(piece.pos_x, piece.pos_y);
+}
+
+bool computer::on_track(void) const {
+  // the plan still works if we are where it says, the food is still there
+  // and nothing got in the way of the next step
+  if(path.empty() || at + 1 >= path.size() || path[at] != head()) return false;
+  if(playground[path.back()] != FOOD) return false;
+  int next = path[at + 1];
+  return !playground[next] || playground[next] == FOOD;
+}
+
+direction heading_to(int from, int to) {
+  // one step, maybe over the edge of the board
+  int width = playground.width;
+  direction way = {0, 0};
+  int dx = to % width - from % width, dy = to / width - from / width;
+  if(dx == 1 || dx < -1) way.x = 1;
+  else if(dx == -1 || dx > 1) way.x = -1;
+  else if(dy == 1 || dy < -1) way.y = 1;
+  else way.y = -1;
+  return way;
+}
+
+int free_cells_around(int pos) {
+  int around[4];
+  neighbours_of(pos, around);
+  int count = 0;
+  for(int n = 0; n < 4; n++) {
+    if(!playground[around[n]] || playground[around[n]] == FOOD) count++;
+  }
+  return count;
+}
+
+int computer::ahead(int from, int steps, int& count) const {
+  // the cell up to steps straight on from from, as far as it's free
+  player* worm = players[number-1];
+  int way = worm->move_x ? (worm->move_x > 0 ? 0 : 1) : (worm->move_y > 0 ? 2 : 3);
+  int around[4];
+  for(count = 0; count < steps; count++) {
+    neighbours_of(from, around);
+    int next = around[way];
+    if((playground[next] && playground[next] != FOOD) || free_cells_around(next) == 0) break;
+    from = next;
+  }
+  return from;
+}
+
+bool computer::join_path(void) {
+  // the plan starts where we would be by now going straight on. if we're
+  // not there yet the way to it goes first
+  int here = head(), cell = here, steps = 0, moved;
+  while(cell != path[0] && steps < planned_ahead) {
+    cell = ahead(cell, 1, moved);
+    if(!moved) break;
+    steps++;
+  }
+  if(cell == path[0]) {
+    path.insert(path.begin(), steps, 0);
+    for(int i = 0; i < steps; i++) path[i] = i ? ahead(path[i-1], 1, moved) : here;
+    at = 0;
+    return true;
+  }
+  // otherwise the furthest cell of the path we are on or can step on next
+  int around[4];
+  neighbours_of(here, around);
+  for(size_t i = path.size(); i-- > 0; ) {
+    if(path[i] == here) {
+      at = i;
+      return true;
+    }
+    if(!i || (playground[path[i]] && playground[path[i]] != FOOD)) continue;
+    for(int n = 0; n < 4; n++) {
+      if(around[n] != path[i]) continue;
+      // a step off where the plan was made
+      at = i - 1;
+      path[at] = here;
+      return true;
+    }
+  }
+  return false;
+}
+
+direction computer::free_way(void) const {
+  // straight on if that's free, otherwise to the side with more room
+  player* worm = players[number-1];
+  direction ways[3] = {{worm->move_x, worm->move_y},
+                       {worm->move_y, -worm->move_x},
+                       {-worm->move_y, worm->move_x}};
+  direction best = ways[0];
+  int best_room = -1;
+  for(int w = 0; w < 3; w++) {
+    wormpiece& piece = worm->body.head();
+    int x = piece.pos_x + ways[w].x, y = piece.pos_y + ways[w].y;
+    if(x > play_x) x = 1;
+    if(x < 1) x = play_x;
+    if(y > play_y) y = 1;
+    if(y < 1) y = play_y;
+    int pos = playground.index(x, y);
+    if(playground[pos] && playground[pos] != FOOD) continue;
+    int room = free_cells_around(pos);
+    if(w == 0 && room > 0) return ways[0];
+    if(room > best_room) {
+      best = ways[w];
+      best_room = room;
+    }
+  }
+  return best;
+}
+
+void meet_computers(void) {
+  // a new round has new players, and maybe a board of another size. the
+  // players may well be where the last round's were in memory, so the
+  // round counter tells
+  if(planned_round == rounds_started) return;
+  planned_round = rounds_started;
+  // the paths keep their room from round to round
+  int first = std::max(1, (int)players.size() - computer_players + 1);
+  computers.resize(players.size() - first + 1, computer(0));
+  for(size_t i = 0; i < computers.size(); i++) {
+    computer& c = computers[i];
+    c.number = first + i;
+    c.path.clear();
+    c.path.reserve(playground.size());
+    c.at = 0;
+    c.resting = 0;
+    c.walled_in = false;
+  }
+  finder.prepare();
+  searching = -1;
+  next_computer = 0;
+}
+
+bool start_search(computer& c, int& budget) {
+  // to the food that's closest if nothing was in the way. after a search
+  // that found no way only of the food that can be got to, false if there's
+  // none. the flood fill costs a cell of the budget for every 64, boards too
+  // big for the whole budget go without
+  food.positions(food_cells);
+  if(food_cells.empty()) return false;
+  // we go straight on while looking, about as long as the last search took
+  int from = c.ahead(c.head(), search_ticks + search_ticks / 2, c.planned_ahead);
+  c.started = thinking_ticks;
+  bool flooded = c.walled_in && (playground.size() / 64 <= THINKING_BUDGET);
+  if(flooded) {
+    if(reachable.width != playground.width || reachable.height != playground.height) {
+      in_the_way.resize(playground.width, playground.height);
+      reachable.resize(playground.width, playground.height);
+    }
+    in_the_way.unite(playground.wall_bits, playground.worm_bits);
+    in_the_way.reset(from);
+    reachable.clear();
+    reachable.set(from);
+    reachable.flood(in_the_way);
+    budget -= playground.size() / 64;
+  }
+  int target = -1, best = 0;
+  for(size_t i = 0; i < food_cells.size(); i++) {
+    if(flooded && !reachable.test(food_cells[i])) continue;
+    int away = steps_between(from, food_cells[i]);
+    if(target == -1 || away < best) {
+      target = food_cells[i];
+      best = away;
+    }
+  }
+  if(target == -1) return false;
+  finder.start(from, target);
+  return true;
+}
+
+void think(void) {
+  // every computer worm queues a turn for this tick, if it wants one
+  if(!computer_players || players.empty()) return;
+  PROFILE(phase_think);
+  thinking_ticks++;
+  meet_computers();
+  if(computers.empty()) return;
+
+  // give the search as much of the budget as it needs, worms that lost
+  // their way line up for the rest
+  int budget = THINKING_BUDGET;
+  for(size_t tried = 0; budget > 0 && tried <= computers.size(); ) {
+    if(searching == -1) {
+      computer& c = computers[next_computer];
+      next_computer = (next_computer + 1) % computers.size();
+      tried++;
+      if(!players[c.number-1]->is_alive || c.on_track()) continue;
+      if(c.resting > 0) continue;
+      if(!start_search(c, budget)) {
+        // nothing to get to, look again later
+        c.resting = REST_TICKS;
+        continue;
+      }
+      searching = &c - &computers[0];
+    }
+    if(!finder.search(budget)) break;
+    computer& c = computers[searching];
+    searching = -1;
+    search_ticks = thinking_ticks - c.started;
+    finder.path(c.path);
+    c.at = 0;
+    // we have moved on while looking, the plan is still good from where
+    // we are if that is on it or next to it
+    c.walled_in = !finder.found;
+    if(!finder.found) c.resting = REST_TICKS;
+    else if(!c.join_path()) c.path.clear();
+  }
+
+  for(size_t i = 0; i < computers.size(); i++) {
+    computer& c = computers[i];
+    player* worm = players[c.number-1];
+    if(!worm->is_alive) continue;
+    if(c.resting > 0) c.resting--;
+    direction turn;
+    if(c.on_track()) {
+      turn = heading_to(c.head(), c.next_cell());
+      c.at++;
+    }
+    else turn = c.free_way();
+    if(turn.x != worm->move_x || turn.y != worm->move_y) commands[c.number-1].push(turn);
+  }
+}
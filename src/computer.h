@@ -0,0 +1,6 @@
+#ifndef WORM_COMPUTER_H
+#define WORM_COMPUTER_H
+class pathfinder;
+class computer;
+#include "computer.cpp"
+#endif
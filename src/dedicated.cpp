@@ -0,0 +1,359 @@
+// a dedicated server: no terminal, no local player, just the simulation and
+// as many remote players as there are worms. all sockets are non-blocking and
+// served from one epoll loop, which also waits for the next tick.
+//
+// the protocol, in messages as network.cpp frames them:
+//   both ways on connect:        the hello of network::hello()
+//   server to client then:       player number (0 if full), width, height
+//   server to client every tick: round, level, number of players, a frame of
+//                                the playground, then per player move_x,
+//                                move_y, score and alive
+//   client to server any time:   input_x, input_y
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <vector>
+
+#include "game.h"
+#include "network.h"
+#include "scheduler.h"
+#include "replay.h"
+#include "spectate.h"
+
+// a client with more than this waiting to be sent can't keep up, drop it
+const size_t MAX_OUTBOX = 1 << 20;
+const int MAX_EVENTS = 64;
+
+// ctrl-c or kill ends run(), so whatever is being recorded gets its end
+volatile sig_atomic_t stop_serving = 0;
+
+void stop_server(int) {
+  stop_serving = 1;
+}
+
+class connection {
+  public:
+    connection(int fd, int number);
+    ~connection(void);
+    size_t backlog(void) const {return outbox.size() - outbox_sent;}
+
+    int fd;
+    int number;            // the player this client steers
+    bool needs_keyframe;
+    bool greeted;          // the client's hello came and was right
+    bool wants_writing;    // EPOLLOUT is switched on
+    std::vector<uint8_t> inbox;
+    std::vector<uint8_t> outbox;
+    size_t outbox_sent;    // bytes at the front of outbox already written
+};
+
+class dedicated {
+  public:
+    dedicated(const char* port, int slots, int tick_ms);
+    ~dedicated(void);
+    void run(void);
+
+  private:
+    void accept_clients(void);
+    bool read_from(connection* c);
+    bool write_to(connection* c);
+    void watch(connection* c);
+    void drop(connection* c);
+    void start_round(void);
+    void tick(void);
+    void broadcast(void);
+
+    int listen_fd, epoll_fd;
+    std::vector<connection*> slots; // slots[n-1] steers player n, or NULL
+    int round;
+    scheduler ticker;
+    std::vector<uint8_t> delta, keyframe, states;
+};
+
+connection::connection(int fd, int number) {
+  this->fd = fd;
+  this->number = number;
+  needs_keyframe = true;
+  greeted = false;
+  wants_writing = false;
+  outbox_sent = 0;
+}
+
+connection::~connection(void) {
+  close(fd);
+}
+
+dedicated::dedicated(const char* port, int slots, int tick_ms) : ticker(tick_ms) {
+  struct addrinfo hints, *result, *r;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  if(getaddrinfo(NULL, port, &hints, &result) != 0) error("getaddrinfo");
+  for(r = result; r != NULL; r = r->ai_next) {
+    listen_fd = socket(r->ai_family, r->ai_socktype, r->ai_protocol);
+    if(listen_fd == -1) continue;
+    int yes = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if(bind(listen_fd, r->ai_addr, r->ai_addrlen) == 0) break;
+    close(listen_fd);
+  }
+  if(!r) error("socket/bind");
+  freeaddrinfo(result);
+  if(listen(listen_fd, SOMAXCONN) == -1) error("listen");
+  set_nonblocking(listen_fd);
+
+  epoll_fd = epoll_create1(0);
+  if(epoll_fd == -1) error("epoll_create1");
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = NULL; // the listening socket
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+
+  this->slots.assign(slots, (connection*)NULL);
+  round = 0;
+  gamemode = dedicated_server;
+  player_count = slots;
+}
+
+dedicated::~dedicated(void) {
+  for(size_t i = 0; i < slots.size(); i++) delete slots[i];
+  close(epoll_fd);
+  close(listen_fd);
+}
+
+void dedicated::run(void) {
+  struct epoll_event events[MAX_EVENTS];
+  signal(SIGINT, stop_server);
+  signal(SIGTERM, stop_server);
+  start_round();
+  ticker.restart();
+  while(!stop_serving) {
+    // sleep in epoll until something happens or the next tick is due
+    int count = epoll_wait(epoll_fd, events, MAX_EVENTS, ticker.ms_to_deadline());
+    if(count == -1 && errno != EINTR) error("epoll_wait");
+    if(count > 0) {
+      PROFILE(phase_network);
+      for(int i = 0; i < count; i++) {
+        connection* c = (connection*)events[i].data.ptr;
+        if(!c) {
+          accept_clients();
+          continue;
+        }
+        if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+          if(!read_from(c)) continue; // dropped
+        }
+        if(events[i].events & EPOLLOUT) write_to(c);
+      }
+    }
+    if(ticker.ms_to_deadline() == 0) {
+      ticker.wait();
+      tick();
+    }
+  }
+}
+
+void dedicated::accept_clients(void) {
+  while(true) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if(fd == -1) return; // EAGAIN, all pending connections taken
+    set_nonblocking(fd);
+    set_nodelay(fd);
+    int number = 0;
+    for(size_t i = 0; i < slots.size() && !number; i++) {
+      if(!slots[i]) number = i + 1;
+    }
+    // both messages framed: hello, then the welcome
+    int greeting[7] = {8, PROTOCOL_MAGIC, PROTOCOL_VERSION, 12, number, play_x, play_y};
+    uint8_t bytes[28];
+    put_ints(bytes, greeting, 7);
+    if(!number) {
+      // full, tell and forget. a write of 28 bytes to a fresh socket
+      // doesn't block
+      if(write(fd, bytes, sizeof(bytes))) {}
+      close(fd);
+      continue;
+    }
+    connection* c = new connection(fd, number);
+    slots[number-1] = c;
+    c->outbox.insert(c->outbox.end(), bytes, bytes + sizeof(bytes));
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = c;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    watch(c);
+    printf("player %d joined\n", number);
+    fflush(stdout);
+  }
+}
+
+bool dedicated::read_from(connection* c) {
+  // false if the client is gone and c deleted
+  uint8_t buffer[4096];
+  while(true) {
+    ssize_t got = read(c->fd, buffer, sizeof(buffer));
+    if(got > 0) {
+      c->inbox.insert(c->inbox.end(), buffer, buffer + got);
+      continue;
+    }
+    if(got == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    drop(c); // EOF or error
+    return false;
+  }
+  // queue every complete turn for the worm, after the hello. heartbeats
+  // are empty
+  size_t used = 0;
+  while(c->inbox.size() - used >= 4) {
+    int length = get_int(&c->inbox[used]);
+    if(length != 0 && length != 8) {
+      drop(c); // not one of ours
+      return false;
+    }
+    if(c->inbox.size() - used - 4 < (size_t)length) break;
+    int input[2];
+    get_ints(&c->inbox[used + 4], input, length / 4);
+    used += 4 + length;
+    if(!length) continue;
+    if(!c->greeted) {
+      if(input[0] != PROTOCOL_MAGIC || input[1] != PROTOCOL_VERSION) {
+        drop(c);
+        return false;
+      }
+      c->greeted = true;
+      continue;
+    }
+    direction turn = {input[0], input[1]};
+    commands[c->number-1].push(turn);
+  }
+  c->inbox.erase(c->inbox.begin(), c->inbox.begin() + used);
+  return true;
+}
+
+bool dedicated::write_to(connection* c) {
+  // false if the client is gone and c deleted
+  while(c->backlog() > 0) {
+    ssize_t written = send(c->fd, &c->outbox[c->outbox_sent], c->backlog(), MSG_NOSIGNAL);
+    if(written > 0) {
+      c->outbox_sent += written;
+      continue;
+    }
+    if(written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    drop(c);
+    return false;
+  }
+  if(c->backlog() == 0) {
+    c->outbox.clear();
+    c->outbox_sent = 0;
+  }
+  watch(c);
+  return true;
+}
+
+void dedicated::watch(connection* c) {
+  // only ask for EPOLLOUT while there is something to write
+  bool wants_writing = (c->backlog() > 0);
+  if(wants_writing == c->wants_writing) return;
+  c->wants_writing = wants_writing;
+  struct epoll_event event;
+  event.events = EPOLLIN | (wants_writing ? (uint32_t)EPOLLOUT : 0u);
+  event.data.ptr = c;
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c->fd, &event);
+}
+
+void dedicated::drop(connection* c) {
+  printf("player %d left\n", c->number);
+  fflush(stdout);
+  if(c->number <= (int)players.size()) {
+    players[c->number-1]->is_alive = false;
+    record_leave(c->number);
+  }
+  slots[c->number-1] = NULL;
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+  delete c;
+}
+
+void dedicated::start_round(void) {
+  // worms for everybody connected, the other slots stay empty
+  round++;
+  level = (rand() % level_count());
+  match_random.seed(rand());
+  new_round();
+  for(size_t i = 0; i < slots.size(); i++) {
+    if(!slots[i]) {
+      players[i]->vanish();
+      players[i]->is_alive = false;
+    }
+    else slots[i]->needs_keyframe = true;
+  }
+  gamestate = running;
+  record_round();
+}
+
+void dedicated::tick(void) {
+  bool anybody_connected = false;
+  for(size_t i = 0; i < slots.size(); i++) {
+    if(slots[i]) anybody_connected = true;
+  }
+  if(!anybody_connected) return;
+  PROFILE(phase_tick);
+
+  // a new round once nobody is left alive, latecomers get to play then
+  if(gamestate == stopping) start_round();
+  move_players();
+  update_food();
+  spawn_food();
+  detect_collisions();
+  record_tick();
+  broadcast();
+  if(audience) audience->publish(round, false);
+}
+
+void dedicated::broadcast(void) {
+  // encode the tick once for everybody. keyframes only when somebody needs
+  // one, for example because they just joined
+  PROFILE(phase_network);
+  int header[3] = {round, level, (int)players.size()};
+  delta.clear();
+  keyframe.clear();
+  states.clear();
+  for(size_t i = 0; i < players.size(); i++) {
+    int state[4] = {players[i]->move_x, players[i]->move_y,
+                    players[i]->score, players[i]->is_alive};
+    append_ints(states, state, 4);
+  }
+  bool everybody_keyframe = keyframe_is_cheaper(playground);
+  if(!everybody_keyframe) encode_playground(playground, false, delta);
+
+  for(size_t i = 0; i < slots.size(); i++) {
+    connection* c = slots[i];
+    if(!c) continue;
+    if(c->backlog() > MAX_OUTBOX) {
+      drop(c);
+      continue;
+    }
+    // nothing but our hello before theirs has come and was right, the
+    // first tick after that has all of the playground
+    if(!c->greeted) {
+      c->needs_keyframe = true;
+      continue;
+    }
+    bool sends_keyframe = (everybody_keyframe || c->needs_keyframe);
+    if(sends_keyframe && keyframe.empty()) encode_playground(playground, true, keyframe);
+    std::vector<uint8_t>& frame = sends_keyframe ? keyframe : delta;
+    int length = sizeof(header) + frame.size() + states.size();
+    append_ints(c->outbox, &length, 1);
+    append_ints(c->outbox, header, 3);
+    c->outbox.insert(c->outbox.end(), frame.begin(), frame.end());
+    if(sends_keyframe) c->needs_keyframe = false;
+    c->outbox.insert(c->outbox.end(), states.begin(), states.end());
+    write_to(c);
+  }
+}
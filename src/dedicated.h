@@ -0,0 +1,6 @@
+#ifndef WORM_DEDICATED_H
+#define WORM_DEDICATED_H
+class connection;
+class dedicated;
+#include "dedicated.cpp"
+#endif
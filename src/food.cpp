@@ -0,0 +1,170 @@
+// the food on the playground. items live in a slab that is reused from round
+// to round, expire through a timer wheel with a bucket per tick and are found
+// by the cell they're on. nothing here depends on how much food there is,
+// except clear().
+
+#include <vector>
+
+#include "grid.h"
+#include "message.h"
+
+const int FOOD_LIFETIME = 101;  // ticks from spawning until it's gone
+const int FOOD_WHEEL = 128;     // buckets, a power of two above FOOD_LIFETIME
+
+class food_manager {
+  public:
+    food_manager(void);
+    void reset(grid& board);  // no food, for a new round on this board
+    void clear(void);
+    void advance(void);       // next tick, food whose time is up disappears
+    void place(int pos);      // on an empty cell
+    bool eat(int pos);        // false if there's no food at pos
+    int count(void) const {return live;}
+    void positions(std::vector<int>& out) const; // of all food, in no particular order
+    void save(message& out) const;
+    bool load(const message& in, size_t& from); // after reset()
+
+  private:
+    struct item {
+      int pos;
+      long expires;           // the tick it disappears in
+      int prev, next;         // in its bucket, or next free item
+    };
+    void insert(int pos, long expires);
+    void unlink(int i);
+
+    grid* board;
+    long now;
+    int live;
+    std::vector<item> items;
+    int free_items;           // first unused item, -1 if there is none
+    std::vector<int> at;      // the item on a cell, -1 for none
+    int buckets[FOOD_WHEEL];  // first item expiring in tick % FOOD_WHEEL
+};
+
+food_manager::food_manager(void) {
+  board = NULL;
+  now = 0;
+  live = 0;
+  free_items = -1;
+  for(int b = 0; b < FOOD_WHEEL; b++) buckets[b] = -1;
+}
+
+void food_manager::reset(grid& board) {
+  clear();
+  this->board = &board;
+  at.assign(board.size(), -1);
+}
+
+void food_manager::clear(void) {
+  // give every item back to the slab, the cells are cleared with the board
+  for(int b = 0; b < FOOD_WHEEL; b++) {
+    while(buckets[b] != -1) {
+      int i = buckets[b];
+      unlink(i);
+      at[items[i].pos] = -1;
+    }
+  }
+  live = 0;
+}
+
+void food_manager::advance(void) {
+  now++;
+  int* bucket = &buckets[now & (FOOD_WHEEL - 1)];
+  while(*bucket != -1) {
+    int i = *bucket;
+    int pos = items[i].pos;
+    unlink(i);
+    at[pos] = -1;
+    // unless a worm's head took its place already
+    if((*board)[pos] == FOOD) board->set(pos, 0);
+  }
+}
+
+void food_manager::place(int pos) {
+  insert(pos, now + FOOD_LIFETIME);
+  board->set(pos, FOOD);
+}
+
+void food_manager::positions(std::vector<int>& out) const {
+  out.clear();
+  for(int b = 0; b < FOOD_WHEEL; b++) {
+    for(int i = buckets[b]; i != -1; i = items[i].next) out.push_back(items[i].pos);
+  }
+}
+
+void food_manager::save(message& out) const {
+  // every bucket in order, items that expire in the same tick disappear in
+  // the order they're listed and that decides where food spawns next
+  int header[2] = {(int)now, live};
+  append_ints(out, header, 2);
+  for(int b = 0; b < FOOD_WHEEL; b++) {
+    int count = 0;
+    for(int i = buckets[b]; i != -1; i = items[i].next) count++;
+    append_ints(out, &count, 1);
+    for(int i = buckets[b]; i != -1; i = items[i].next) {
+      int saved[2] = {items[i].pos, (int)(items[i].expires - now)};
+      append_ints(out, saved, 2);
+    }
+  }
+}
+
+bool food_manager::load(const message& in, size_t& from) {
+  int header[2];
+  if(!read_ints(in, from, header, 2)) return false;
+  now = header[0];
+  std::vector<int> bucket;
+  for(int b = 0; b < FOOD_WHEEL; b++) {
+    int count;
+    if(!read_ints(in, from, &count, 1) || count < 0 || count > (int)at.size()) return false;
+    bucket.resize(count*2);
+    if(count && !read_ints(in, from, &bucket[0], count*2)) return false;
+    // insert() puts items first, so back to front keeps the order
+    for(int i = count - 1; i >= 0; i--) {
+      int pos = bucket[i*2], left = bucket[i*2+1];
+      if(pos < 0 || pos >= (int)at.size() || at[pos] != -1) return false;
+      if(left < 1 || left > FOOD_LIFETIME) return false;
+      if(((now + left) & (FOOD_WHEEL - 1)) != b) return false;
+      insert(pos, now + left);
+    }
+  }
+  return live == header[1];
+}
+
+void food_manager::insert(int pos, long expires) {
+  int i = free_items;
+  if(i == -1) {
+    items.push_back(item());
+    i = items.size() - 1;
+  }
+  else free_items = items[i].next;
+  item& it = items[i];
+  it.pos = pos;
+  it.expires = expires;
+  int& bucket = buckets[it.expires & (FOOD_WHEEL - 1)];
+  it.prev = -1;
+  it.next = bucket;
+  if(bucket != -1) items[bucket].prev = i;
+  bucket = i;
+  at[pos] = i;
+  live++;
+}
+
+bool food_manager::eat(int pos) {
+  int i = at[pos];
+  if(i == -1) return false;
+  unlink(i);
+  at[pos] = -1;
+  return true;
+}
+
+void food_manager::unlink(int i) {
+  // take an item out of its bucket and give it back to the slab
+  item& it = items[i];
+  if(it.prev != -1) items[it.prev].next = it.next;
+  else buckets[it.expires & (FOOD_WHEEL - 1)] = it.next;
+  if(it.next != -1) items[it.next].prev = it.prev;
+  it.next = free_items;
+  free_items = i;
+  live--;
+}
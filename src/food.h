@@ -0,0 +1,5 @@
+#ifndef WORM_FOOD_H
+#define WORM_FOOD_H
+class food_manager;
+#include "food.cpp"
+#endif
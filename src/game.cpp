@@ -0,0 +1,525 @@
+// the simulation of a round: players, food and the playground they live in.
+// nothing in here touches ncurses, so it can run without a terminal.
+
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+
+#include "grid.h"
+#include "level.h"
+#include "wormbody.h"
+#include "random.h"
+#include "spsc.h"
+#include "food.h"
+#include "message.h"
+#include "threadpool.h"
+#include "profiler.h"
+
+// prototypes -----------------------------------------------------------------
+class player;
+bool is_authoritative(void);
+
+// global constants -----------------------------------------------------------
+const int INITIAL_MAX_WORMLENGTH = 3;
+const int START_SPACING = 8;  // columns between worms that start in one row
+
+// global enums
+enum gamemodes {not_set, single, local_multi, network_host, network_client,
+                dedicated_server, dedicated_client, replaying, versus_computer,
+                spectating};
+enum gamestates {starting, running, stopping, stopped};
+
+// global variables -----------------------------------------------------------
+int play_x, play_y;
+grid playground;
+int level;
+std::vector<player*> players; // players[n-1] is player number n
+int player_count = 2;         // how many new_round() creates
+int rounds_started = 0;       // by new_round(), tells one round from the next
+player* player1 = NULL;       // shortcuts to players[0] and players[1]
+player* player2 = NULL;
+food_manager food;
+int food_count = 3;           // never more food than this at once
+prng match_random;            // seeded for each round, all chance comes from it
+gamemodes gamemode;
+gamestates gamestate;
+
+// turns wait here until the worm takes them, see player::take_turn(). they
+// outlive the players of a round, so whoever pushes never touches a player
+struct direction {int x, y;};
+spsc_queue<direction> commands[MAX_PLAYER_NUMBER]; // commands[n-1] steers player n
+
+// classes --------------------------------------------------------------------
+class player {
+  public:
+    player(int num);
+    void pull_tail(void);
+    void take_turn(void);
+    void plan(void);
+    void move(void);
+    void vanish(void);
+    bool collision(void);
+    bool eats_food(void);
+    bool can_head(int x, int y) const;
+
+    int number;
+    int move_x;
+    int move_y;
+    int wormlength;
+    int input_x;
+    int input_y;
+    int max_wormlength;
+    wormbody body;
+    int score;
+    int highscore;
+    bool is_alive;
+    int target;               // where plan() wants the head to go
+    bool crashed;             // and whether it goes into something there
+};
+
+// class functions ------------------------------------------------------------
+player::player(int num) {
+  this->number = num;
+  // odd players start on the left heading right, even players on the right
+  // heading left. players 1 and 2 get the top and bottom row, more players
+  // take every other row from there. when the rows run out the next ones
+  // start further in, but not as far as the block of level 2
+  int slot = (this->number - 1) / 2;
+  int rows = std::max(1, (play_y - 4) / 2);
+  int columns = std::max(1, (play_x * 2 / 7 - 4) / START_SPACING);
+  int row = slot % rows * 2;
+  int column = slot / rows % columns * START_SPACING;
+  if(this->number % 2) {
+	  this->input_x = 1;
+	  this->input_y = 0;
+    this->body.push_head(3 + column, 3 + row);
+  }
+  else {
+	  this->input_x = -1;
+	  this->input_y = 0;
+    this->body.push_head(play_x-2 - column, play_y-3 - row);
+  }
+  this->move_x = this->input_x;
+  this->move_y = this->input_y;
+  this->wormlength = 1;
+  this->max_wormlength = INITIAL_MAX_WORMLENGTH;
+  this->score = 0;
+  this->highscore = 0;
+  this->is_alive = true;
+  this->target = 0;
+  this->crashed = false;
+}
+
+void player::pull_tail(void) {
+  // drop the tail if the worm is long enough, so there's room for a new head.
+  // only clear cells still showing this worm, a head may have moved in.
+  while(this->body.length() >= this->max_wormlength) {
+    wormpiece& tail = this->body.tail();
+    if(playground.get(tail.pos_x, tail.pos_y) == make_cell(WORM, this->number)) {
+      playground.set(tail.pos_x, tail.pos_y, 0);
+    }
+    this->body.pop_tail();
+  }
+}
+
+void player::take_turn(void) {
+  // one queued turn per tick, so quick turns all happen. turns that change
+  // nothing or would reverse into the worm are dropped here and don't hold
+  // up the ones behind them
+  direction turn;
+  while(commands[this->number-1].pop(turn)) {
+    if(turn.x == this->move_x && turn.y == this->move_y) continue;
+    if(!this->can_head(turn.x, turn.y)) continue;
+    this->input_x = turn.x;
+    this->input_y = turn.y;
+    return;
+  }
+}
+
+void player::plan(void) {
+  // where the head goes this tick. this only reads the playground, the
+  // worms plan all at once and move after that
+  this->take_turn();
+  this->move_x = this->input_x;
+  this->move_y = this->input_y;
+  wormpiece& head = this->body.head();
+  int pos_x = head.pos_x + this->move_x;
+  int pos_y = head.pos_y + this->move_y;
+  // check if we crossed the playground border
+  if(pos_x > play_x) pos_x = pos_x - play_x;
+  if(pos_x < 1) pos_x = play_x;
+  if(pos_y > play_y) pos_y = pos_y - play_y;
+  if(pos_y < 1) pos_y = play_y;
+  this->target = playground.index(pos_x, pos_y);
+  // tails are gone already, a head there becomes body when its worm moves
+  int kind = cell_kind(playground[this->target]);
+  this->crashed = (kind == WALL || kind == WORM || kind == WORMHEAD);
+}
+
+void player::move(void) {
+  // the old head becomes part of the body
+  wormpiece& old_head = this->body.head();
+  cellvalue old_cell = playground.get(old_head.pos_x, old_head.pos_y);
+  if(old_cell == 0 || old_cell == FOOD || old_cell == make_cell(WORMHEAD, this->number)) {
+    playground.set(old_head.pos_x, old_head.pos_y, make_cell(WORM, this->number));
+  }
+  // push the new head plan() found. a worm that crashes leaves the cell to
+  // whatever is in it, for vanish() not to take away
+  this->body.push_head(playground.column(this->target), playground.row(this->target));
+  this->wormlength = this->body.length();
+  if(!this->crashed) playground.set(this->target, make_cell(WORMHEAD, this->number));
+}
+
+void player::vanish(void) {
+  // take a dead worm off the playground
+  for(int i = 0; i < this->wormlength; i++) {
+    wormpiece& piece = this->body.at(i);
+    cellvalue cell = playground.get(piece.pos_x, piece.pos_y);
+    if(cell_player(cell) == this->number) {
+      playground.set(piece.pos_x, piece.pos_y, 0);
+    }
+  }
+  this->wormlength = 0;
+}
+
+bool player::collision(void) {
+  // found by plan() and find_head_ons(), two heads in one cell don't show
+  if(this->crashed) this->is_alive = false;
+  return this->crashed;
+}
+
+bool player::eats_food(void) {
+  wormpiece& head = this->body.head();
+  // dead worms don't eat, their last head isn't on the playground anymore
+  if(this->is_alive && !this->crashed && food.eat(playground.index(head.pos_x, head.pos_y))) {
+    this->max_wormlength += 5;
+    this->score += this->wormlength*5;
+    return true;
+  }
+  else {return false;}
+}
+
+bool player::can_head(int x, int y) const {
+  // one step in one direction, and not back into the worm itself
+  bool is_step = (abs(x) + abs(y) == 1);
+  bool reverses = (x == -this->move_x && y == -this->move_y);
+  return is_step && !reverses;
+}
+
+// functions ------------------------------------------------------------------
+void draw_level(int level) {
+  // a playground of play_x by play_y with the walls of a level, see level.cpp
+  put_level(playground, level, play_x, play_y);
+}
+
+void new_round(void) {
+  // (re)create the playground for the current play_x and play_y. from here on
+  // it is only changed cell by cell, the walls stay for the whole round
+  PROFILE(phase_round);
+  rounds_started++;
+  if(is_authoritative()) draw_level(level);
+  else playground.resize(play_x, play_y);
+  // the first frame of a round is drawn and sent in full anyway
+  playground.forget_changes();
+
+  // no food left over from the last round
+  food.reset(playground);
+
+  // remove player objects from last round, and the turns nobody took
+  for(size_t i = 0; i < players.size(); i++) delete players[i];
+  players.clear();
+  direction stale;
+  for(int number = 1; number <= MAX_PLAYER_NUMBER; number++) {
+    while(commands[number-1].pop(stale)) {}
+  }
+
+  // create players' worms. their heads are there from the start, so no
+  // worm heads into a cell that only looks empty
+  for(int number = 1; number <= player_count; number++) {
+    player* p = new player(number);
+    players.push_back(p);
+    wormpiece& head = p->body.head();
+    if(is_authoritative() && !playground.get(head.pos_x, head.pos_y)) {
+      playground.set(head.pos_x, head.pos_y, make_cell(WORMHEAD, number));
+    }
+  }
+  player1 = players[0];
+  player2 = (player_count > 1) ? players[1] : NULL;
+}
+
+void clear_players(void) {
+  for(size_t i = 0; i < players.size(); i++) delete players[i];
+  players.clear();
+  player1 = NULL;
+  player2 = NULL;
+}
+
+bool is_authoritative(void) {
+  // clients of a dedicated server and spectators show what somebody else
+  // simulates. everybody else, both sides of a network game included,
+  // simulates themselves
+  return (gamemode!=dedicated_client && gamemode!=spectating);
+}
+
+// the tick -------------------------------------------------------------------
+// worms move in two phases that only read the playground: every worm plans
+// where its head goes, then the heads that go into the same cell are found.
+// the first phase is split between threads by worms, the second by rows of
+// the board, so no two threads look at the same worm or cell. the playground
+// is only written after that, in the order of the players, so a tick comes
+// out the same whatever the number of threads.
+int tick_threads = 1;          // --threads
+thread_pool* tick_pool = NULL; // for more than one thread, made when needed
+std::vector<int> band_worms;   // players[] of the moving worms by band of rows
+std::vector<int> band_start;   // band b is band_worms[band_start[b]] up to band_start[b+1]
+std::vector<int> band_next;
+
+void in_parts(void (*job)(int part, int parts)) {
+  if(tick_threads > 1 && tick_pool && tick_pool->size() != tick_threads) {
+    delete tick_pool;
+    tick_pool = NULL;
+  }
+  if(tick_threads > 1 && !tick_pool) tick_pool = new thread_pool(tick_threads);
+  if(tick_threads > 1) tick_pool->run(job);
+  else job(0, 1);
+}
+
+void plan_moves(int part, int parts) {
+  size_t first = players.size() * part / parts, last = players.size() * (part + 1) / parts;
+  for(size_t i = first; i < last; i++) {
+    if(players[i]->is_alive) players[i]->plan();
+  }
+}
+
+int band_of(int pos, int bands) {
+  return (int)((long)(pos / playground.width) * bands / playground.height);
+}
+
+void sort_into_bands(int bands) {
+  // counting sort by the band of the new head, the worms stay in order
+  band_start.assign(bands + 1, 0);
+  for(size_t i = 0; i < players.size(); i++) {
+    if(players[i]->is_alive) band_start[band_of(players[i]->target, bands) + 1]++;
+  }
+  for(int b = 0; b < bands; b++) band_start[b+1] += band_start[b];
+  band_next.assign(band_start.begin(), band_start.end() - 1);
+  band_worms.resize(band_start[bands]);
+  for(size_t i = 0; i < players.size(); i++) {
+    if(players[i]->is_alive) band_worms[band_next[band_of(players[i]->target, bands)]++] = i;
+  }
+}
+
+bool by_target(int a, int b) {
+  if(players[a]->target != players[b]->target) return players[a]->target < players[b]->target;
+  return a < b;
+}
+
+void find_head_ons(int part, int) {
+  // heads that go into the same cell all crash, whoever came first. there
+  // is a band for every part, sort_into_bands() cut them
+  std::vector<int>::iterator first = band_worms.begin() + band_start[part];
+  std::vector<int>::iterator last = band_worms.begin() + band_start[part+1];
+  std::sort(first, last, by_target);
+  while(first != last) {
+    std::vector<int>::iterator same = first + 1;
+    while(same != last && players[*same]->target == players[*first]->target) same++;
+    if(same - first > 1) {
+      for(std::vector<int>::iterator i = first; i != same; i++) players[*i]->crashed = true;
+    }
+    first = same;
+  }
+}
+
+void move_players(void) {
+  PROFILE(phase_move);
+  // a new tick, changes of the last one have been sent and drawn by now
+  playground.forget_changes();
+
+  // on a client the host moves the worms, we only follow their heading
+  if(!is_authoritative()) {
+    for(size_t i = 0; i < players.size(); i++) {
+      players[i]->move_x = players[i]->input_x;
+      players[i]->move_y = players[i]->input_y;
+    }
+    return;
+  }
+
+  // worms that died last tick leave the playground now
+  for(size_t i = 0; i < players.size(); i++) {
+    if(!players[i]->is_alive && players[i]->wormlength) players[i]->vanish();
+  }
+
+  // free all tails before any head moves, so chasing a tail is allowed
+  for(size_t i = 0; i < players.size(); i++) {
+    if(players[i]->is_alive) players[i]->pull_tail();
+  }
+
+  // where every head goes and which of them meet, then move the player(s)
+  in_parts(plan_moves);
+  sort_into_bands(tick_threads > 1 ? tick_threads : 1);
+  in_parts(find_head_ons);
+  for(size_t i = 0; i < players.size(); i++) {
+    if(players[i]->is_alive) players[i]->move();
+  }
+}
+
+void update_food(void) {
+  // let the worms eat, then expire old food (not on client side). food a
+  // head reaches in the tick it runs out is still eaten. this costs the
+  // same however much food there is
+  PROFILE(phase_food);
+  if(is_authoritative()) {
+    for(size_t i = 0; i < players.size(); i++) players[i]->eats_food();
+    food.advance();
+  }
+}
+
+bool anybody_alive(void) {
+  for(size_t i = 0; i < players.size(); i++) {
+    if(players[i]->is_alive) return true;
+  }
+  return false;
+}
+
+void detect_collisions(void) {
+  PROFILE(phase_collisions);
+  // a client learns who died from the host
+  if(is_authoritative()) {
+    for(size_t i = 0; i < players.size(); i++) {
+      if(players[i]->is_alive) players[i]->collision();
+    }
+  }
+  // if none lives anymore then remember to exit this round
+  if(!anybody_alive()) gamestate = stopping;
+}
+
+void spawn_food(void) {
+  // randomly create new food for the next iteration, on any empty cell with
+  // the same chance
+  PROFILE(phase_spawn);
+  if(is_authoritative()) {
+    // a roll for every three pieces allowed, so big arenas fill up as quickly
+    // as small ones
+    for(int roll = 0; roll < (food_count + 2) / 3 && food.count() < food_count; roll++) {
+      if(!match_random.below(10) && playground.free_count()) {
+        food.place(playground.free_cell(match_random.below(playground.free_count())));
+      }
+    }
+  }
+}
+
+void simulate(void) {
+  // one complete tick without network sync or drawing, see timing() for the
+  // same steps interleaved with those
+  move_players();
+  update_food();
+  spawn_food();
+  detect_collisions();
+}
+
+unsigned long long hash_value(unsigned long long hash, unsigned value) {
+  // one FNV-1a step per byte of value
+  for(int b = 0; b < 4; b++) {
+    hash = (hash ^ ((value >> (b*8)) & 0xff)) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+unsigned long long state_hash(void) {
+  // fingerprint of everything that makes up the state of a round
+  unsigned long long hash = 14695981039346656037ULL;
+  for(int p = 0; p < playground.size(); p++) {
+    hash = hash_value(hash, playground[p]);
+  }
+  for(size_t i = 0; i < players.size(); i++) {
+    hash = hash_value(hash, players[i]->body.head().pos_x);
+    hash = hash_value(hash, players[i]->body.head().pos_y);
+    hash = hash_value(hash, players[i]->score);
+    hash = hash_value(hash, players[i]->is_alive);
+  }
+  return hash;
+}
+
+void save_state(message& out) {
+  // everything simulate() needs to carry on exactly as it would have, see
+  // load_state(). only worth it now and then, it's the whole playground
+  int round[6] = {play_x, play_y, level, (int)players.size(), food_count, gamestate};
+  append_ints(out, round, 6);
+  uint64_t random_state = match_random.save();
+  int random_ints[2] = {(int)(random_state >> 32), (int)(uint32_t)random_state};
+  append_ints(out, random_ints, 2);
+  playground.save(out);
+  food.save(out);
+  for(size_t i = 0; i < players.size(); i++) {
+    player* p = players[i];
+    int fields[11] = {p->move_x, p->move_y, p->input_x, p->input_y,
+                      p->wormlength, p->max_wormlength, p->score, p->highscore,
+                      p->is_alive, p->body.length(), 0};
+    append_ints(out, fields, 11);
+    for(int piece = p->body.length() - 1; piece >= 0; piece--) {
+      int xy[2] = {p->body.at(piece).pos_x, p->body.at(piece).pos_y};
+      append_ints(out, xy, 2);
+    }
+  }
+}
+
+bool load_state(const message& in, size_t& at) {
+  // replaces the round in progress with one saved by save_state(). false if
+  // it's broken, what's left of the round then is no use to anybody
+  int round[6];
+  if(!read_ints(in, at, round, 6)) return false;
+  if(round[3] < 1 || round[3] > MAX_PLAYER_NUMBER || round[4] < 0) return false;
+  if(round[5] < starting || round[5] > stopped) return false;
+  if(round[2] < 0 || round[2] >= level_count()) return false;
+  int random_ints[2];
+  if(!read_ints(in, at, random_ints, 2)) return false;
+  match_random.restore(((uint64_t)(uint32_t)random_ints[0] << 32) | (uint32_t)random_ints[1]);
+  if(!playground.load(in, at)) return false;
+  play_x = round[0];
+  play_y = round[1];
+  if(playground.width != play_x || playground.height != play_y) return false;
+  level = round[2];
+  player_count = round[3];
+  food_count = round[4];
+  gamestate = (gamestates)round[5];
+  food.reset(playground);
+  if(!food.load(in, at)) return false;
+
+  clear_players();
+  direction stale;
+  for(int number = 1; number <= MAX_PLAYER_NUMBER; number++) {
+    while(commands[number-1].pop(stale)) {}
+  }
+  for(int number = 1; number <= player_count; number++) {
+    int fields[11];
+    if(!read_ints(in, at, fields, 11)) return false;
+    // headings are steps of one, a worm fits on the board
+    for(int f = 0; f < 4; f++) {
+      if(fields[f] < -1 || fields[f] > 1) return false;
+    }
+    if(fields[9] < 1 || fields[9] > playground.size()) return false;
+    if(fields[4] < 0 || fields[4] > fields[9] || fields[5] < 1) return false;
+    player* p = new player(number);
+    players.push_back(p);
+    p->move_x = fields[0];
+    p->move_y = fields[1];
+    p->input_x = fields[2];
+    p->input_y = fields[3];
+    p->wormlength = fields[4];
+    p->max_wormlength = fields[5];
+    p->score = fields[6];
+    p->highscore = fields[7];
+    p->is_alive = fields[8];
+    p->body.clear();
+    for(int piece = 0; piece < fields[9]; piece++) {
+      int xy[2];
+      if(!read_ints(in, at, xy, 2)) return false;
+      if(xy[0] < 1 || xy[0] > play_x || xy[1] < 1 || xy[1] > play_y) return false;
+      p->body.push_head(xy[0], xy[1]);
+    }
+  }
+  player1 = players[0];
+  player2 = (player_count > 1) ? players[1] : NULL;
+  playground.forget_changes();
+  return true;
+}
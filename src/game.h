@@ -0,0 +1,6 @@
+#ifndef WORM_GAME_H
+#define WORM_GAME_H
+class player;
+class food;
+#include "game.cpp"
+#endif
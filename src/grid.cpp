@@ -0,0 +1,251 @@
+// the playground as two bytes per cell. the low three bits tell what is in a
+// cell, the high thirteen bits whose it is (0 for walls and food):
+//
+//   15 ... 3 2 1 0
+//   player   kind
+//
+// walls, worms and food are kept as bitboards besides, see bitboard.cpp.
+
+#include <stdint.h>
+#include <string.h>
+
+#include "message.h"
+#include "bitboard.h"
+
+// cell kinds -----------------------------------------------------------------
+const int WALL = 1;
+const int WORMHEAD = 2;
+const int WORM = 3;
+const int FOOD = 4;
+// a cell would have room for 8191, there is a command queue for each of these
+const int MAX_PLAYER_NUMBER = 1023;
+
+typedef uint16_t cellvalue;
+
+inline cellvalue make_cell(int kind, int number = 0) {
+  return (cellvalue)(kind | (number << 3));
+}
+
+inline int cell_kind(cellvalue cell) {
+  return cell & 7;
+}
+
+inline int cell_player(cellvalue cell) {
+  return cell >> 3;
+}
+
+// the grid -------------------------------------------------------------------
+class grid {
+  public:
+    grid(void);
+    ~grid(void);
+    void resize(int width, int height);
+    void clear(void);
+    void copy(const grid& from);
+    void set(int pos, cellvalue value);
+    void set(int x, int y, cellvalue value) {set(index(x, y), value);}
+    void mark_changed(int pos);
+    void forget_changes(void);
+    void save(message& out) const;
+    bool load(const message& in, size_t& at);
+    // the grid is a one-dimensional array with 1-based coordinates.
+    // index(3,1) returns 2 (third element in the array), index(3,4) would
+    // return 32 if the grid had 10 columns.
+    int index(int x, int y) const {return width*(y-1) + x - 1;}
+    cellvalue get(int x, int y) const {return cells[index(x, y)];}
+    cellvalue operator[](int pos) const {return cells[pos];}
+    int size(void) const {return width*height;}
+    int column(int pos) const {return pos % width + 1;}
+    int row(int pos) const {return pos / width + 1;}
+    // the empty cells, free_cell(0) to free_cell(free_count()-1) in no
+    // particular order
+    int free_count(void) const {return free_total;}
+    int free_cell(int i) const {return free_cells[i];}
+
+    int width, height;
+    cellvalue* cells;
+    int* changes;         // cells written since forget_changes()
+    int change_count;
+    bitboard wall_bits, worm_bits, food_bits; // heads are worms too
+
+  private:
+    grid(const grid&);
+    grid& operator=(const grid&);
+    void take(int pos);
+    void release(int pos);
+    bitboard* bits_of(int kind);
+    void sort_bits(void);
+
+    uint8_t* is_changed;
+    int* free_cells;      // positions of the empty cells
+    int* free_slot;       // where a cell is in free_cells, -1 if it isn't empty
+    int free_total;
+};
+
+grid::grid(void) {
+  width = 0;
+  height = 0;
+  cells = NULL;
+  changes = NULL;
+  change_count = 0;
+  is_changed = NULL;
+  free_cells = NULL;
+  free_slot = NULL;
+  free_total = 0;
+}
+
+grid::~grid(void) {
+  delete[] cells;
+  delete[] changes;
+  delete[] is_changed;
+  delete[] free_cells;
+  delete[] free_slot;
+}
+
+void grid::resize(int width, int height) {
+  if(width*height != size()) {
+    delete[] cells;
+    delete[] changes;
+    delete[] is_changed;
+    delete[] free_cells;
+    delete[] free_slot;
+    cells = new cellvalue [width*height];
+    changes = new int [width*height];
+    is_changed = new uint8_t [width*height];
+    free_cells = new int [width*height];
+    free_slot = new int [width*height];
+    memset(is_changed, 0, width*height);
+    change_count = 0;
+  }
+  this->width = width;
+  this->height = height;
+  wall_bits.resize(width, height);
+  worm_bits.resize(width, height);
+  food_bits.resize(width, height);
+  clear();
+}
+
+void grid::clear(void) {
+  // empty every cell without counting it as a change
+  memset(cells, 0, size() * sizeof(cellvalue));
+  for(int pos = 0; pos < size(); pos++) {
+    free_cells[pos] = pos;
+    free_slot[pos] = pos;
+  }
+  free_total = size();
+  wall_bits.clear();
+  worm_bits.clear();
+  food_bits.clear();
+  forget_changes();
+}
+
+void grid::copy(const grid& from) {
+  // the same cells and free cells in the same order, with nothing changed
+  // the shape counts, not only the area: the bitboards have rows of words
+  if(from.width != width || from.height != height) resize(from.width, from.height);
+  memcpy(cells, from.cells, size() * sizeof(cellvalue));
+  memcpy(free_cells, from.free_cells, from.free_total * sizeof(int));
+  memcpy(free_slot, from.free_slot, size() * sizeof(int));
+  free_total = from.free_total;
+  wall_bits.copy(from.wall_bits);
+  worm_bits.copy(from.worm_bits);
+  food_bits.copy(from.food_bits);
+  forget_changes();
+}
+
+void grid::set(int pos, cellvalue value) {
+  // every write goes through here, so the cells that changed in a tick can be
+  // sent or drawn without looking at the whole grid
+  if(cells[pos] == value) return;
+  if(!cells[pos]) take(pos);
+  else if(!value) release(pos);
+  bitboard* before = bits_of(cell_kind(cells[pos]));
+  bitboard* after = bits_of(cell_kind(value));
+  if(before != after) {
+    if(before) before->reset(pos);
+    if(after) after->set(pos);
+  }
+  cells[pos] = value;
+  mark_changed(pos);
+}
+
+bitboard* grid::bits_of(int kind) {
+  if(kind == WALL) return &wall_bits;
+  if(kind == WORM || kind == WORMHEAD) return &worm_bits;
+  if(kind == FOOD) return &food_bits;
+  return NULL;
+}
+
+void grid::sort_bits(void) {
+  // all of them again, from the cells
+  wall_bits.clear();
+  worm_bits.clear();
+  food_bits.clear();
+  for(int pos = 0; pos < size(); pos++) {
+    bitboard* bits = bits_of(cell_kind(cells[pos]));
+    if(bits) bits->set(pos);
+  }
+}
+
+void grid::save(message& out) const {
+  // the order of the free cells decides where food spawns, so it's saved too
+  int header[3] = {width, height, free_total};
+  append_ints(out, header, 3);
+  size_t start = out.size();
+  out.resize(start + size() * sizeof(cellvalue));
+  put_shorts(&out[start], cells, size());
+  append_ints(out, free_cells, free_total);
+}
+
+bool grid::load(const message& in, size_t& at) {
+  // false if what's in there can't be a grid
+  int header[3];
+  if(!read_ints(in, at, header, 3)) return false;
+  if(header[0] < 1 || header[1] < 1 || header[0] > 100000 || header[1] > 100000) return false;
+  // both sides fit, the area may not: a grid's positions are ints
+  int64_t area = (int64_t)header[0] * header[1];
+  if(area > INT32_MAX / (int64_t)sizeof(int)) return false;
+  if(header[2] < 0 || header[2] > area) return false;
+  size_t bytes = (size_t)area * sizeof(cellvalue);
+  if(in.size() < at + bytes) return false;
+  resize(header[0], header[1]);
+  get_shorts(&in[at], cells, size());
+  at += bytes;
+  free_total = header[2];
+  if(!read_ints(in, at, free_cells, free_total)) return false;
+  for(int pos = 0; pos < size(); pos++) free_slot[pos] = -1;
+  for(int i = 0; i < free_total; i++) {
+    int pos = free_cells[i];
+    if(pos < 0 || pos >= size() || cells[pos] || free_slot[pos] != -1) return false;
+    free_slot[pos] = i;
+  }
+  sort_bits();
+  return true;
+}
+
+void grid::take(int pos) {
+  // the last empty cell fills the gap, so this is O(1)
+  int slot = free_slot[pos];
+  int last = free_cells[--free_total];
+  free_cells[slot] = last;
+  free_slot[last] = slot;
+  free_slot[pos] = -1;
+}
+
+void grid::release(int pos) {
+  free_slot[pos] = free_total;
+  free_cells[free_total++] = pos;
+}
+
+void grid::mark_changed(int pos) {
+  if(is_changed[pos]) return;
+  is_changed[pos] = 1;
+  changes[change_count++] = pos;
+}
+
+void grid::forget_changes(void) {
+  for(int i = 0; i < change_count; i++) {
+    is_changed[changes[i]] = 0;
+  }
+  change_count = 0;
+}
@@ -0,0 +1,5 @@
+#ifndef WORM_GRID_H
+#define WORM_GRID_H
+class grid;
+#include "grid.cpp"
+#endif
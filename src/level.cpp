@@ -0,0 +1,293 @@
+// the levels, as text. one statement a line, # starts a comment:
+//
+//   level NAME           a new level, what follows until the next is in it
+//   border               walls all around the board
+//   rect X1 Y1 X2 Y2     walls in columns X1*width+1 to X2*width and rows
+//                        Y1*height+1 to Y2*height, each a fraction like 2/7
+//                        or 0 or 1, rounded down
+//   map W H              walls where the next H lines of W characters have a
+//                        '#', '.' is free. stretched over the whole board
+//
+// the walls go up in the order they're written, which decides the order of
+// the free cells and so where food spawns. a level is compiled once for a
+// size of board into a grid of its own, a round starts with a copy of that.
+// "--levels FILE" adds the levels of FILE after the built-in ones.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#include "grid.h"
+
+const int BUILTIN_LEVELS = 4;       // what a network game chooses from, both ends have them
+const int MAX_LEVELS = 256;
+const int MAX_MAP_SIDE = 4096;
+const int MAX_DENOMINATOR = 1000;
+const long LEVEL_CACHE_CELLS = 1 << 22; // all compiled levels together, bigger boards aren't kept
+
+const char* BUILTIN_LEVEL_TEXT =
+  "level open\n"
+  "level walled\n"
+  "border\n"
+  "level block\n"
+  "rect 2/7 3/7 5/7 4/7\n"
+  "level walled block\n"
+  "border\n"
+  "rect 2/7 3/7 5/7 4/7\n";
+
+enum shape_kinds {shape_border, shape_rect, shape_map};
+
+struct level_shape {
+  shape_kinds kind;
+  int numerator[4], denominator[4]; // a rect's X1 Y1 X2 Y2
+  int map_width, map_height;
+  std::vector<uint8_t> map;         // 1 for a wall, row after row
+};
+
+struct level_spec {
+  std::string name;
+  std::vector<level_shape> shapes;
+  bool has_border;                  // the built-in ones are coloured by that
+};
+
+struct level_template {
+  int number;
+  grid board;
+};
+
+std::vector<level_spec> levels;
+std::vector<level_template*> level_cache; // the oldest first
+std::string level_error;                  // why the last load_levels() failed
+
+// reading --------------------------------------------------------------------
+bool read_fraction(const char* word, int& numerator, int& denominator) {
+  // "0", "1" or "N/D" with N <= D
+  char* end;
+  long n = strtol(word, &end, 10), d = 1;
+  if(end == word) return false;
+  if(*end == '/') {
+    const char* rest = end + 1;
+    d = strtol(rest, &end, 10);
+    if(end == rest) return false;
+  }
+  if(*end || n < 0 || d < 1 || d > MAX_DENOMINATOR || n > d) return false;
+  numerator = n;
+  denominator = d;
+  return true;
+}
+
+bool parse_levels(const char* text, size_t length, std::vector<level_spec>& into) {
+  // false with level_error set if anything in there isn't right
+  std::vector<level_spec> found;
+  size_t at = 0;
+  int line = 0;
+  char problem[160];
+  problem[0] = '\0';
+  while(at < length && !problem[0]) {
+    // the next line, without its comment
+    size_t end = at;
+    while(end < length && text[end] != '\n') end++;
+    std::string statement(text + at, end - at);
+    at = end + 1;
+    line++;
+    size_t hash = statement.find('#');
+    if(hash != std::string::npos) statement.erase(hash);
+    std::vector<std::string> words;
+    char* save;
+    for(char* word = strtok_r(&statement[0], " \t\r", &save); word; word = strtok_r(NULL, " \t\r", &save)) {
+      words.push_back(word);
+    }
+    if(words.empty()) continue;
+
+    if(words[0] == "level") {
+      if(words.size() < 2) snprintf(problem, sizeof(problem), "a level needs a name");
+      else if(into.size() + found.size() >= (size_t)MAX_LEVELS) snprintf(problem, sizeof(problem), "more than %d levels", MAX_LEVELS);
+      else {
+        level_spec spec;
+        spec.name = words[1];
+        for(size_t i = 2; i < words.size(); i++) spec.name += " " + words[i];
+        spec.has_border = false;
+        found.push_back(spec);
+      }
+      continue;
+    }
+    if(found.empty()) {
+      snprintf(problem, sizeof(problem), "'%s' before the first level", words[0].c_str());
+      continue;
+    }
+    level_shape shape;
+    shape.map_width = shape.map_height = 0;
+    if(words[0] == "border" && words.size() == 1) {
+      shape.kind = shape_border;
+      found.back().has_border = true;
+    }
+    else if(words[0] == "rect" && words.size() == 5) {
+      shape.kind = shape_rect;
+      for(int i = 0; i < 4 && !problem[0]; i++) {
+        if(!read_fraction(words[i+1].c_str(), shape.numerator[i], shape.denominator[i])) {
+          snprintf(problem, sizeof(problem), "'%s' isn't a fraction from 0 to 1", words[i+1].c_str());
+        }
+      }
+    }
+    else if(words[0] == "map" && words.size() == 3) {
+      shape.kind = shape_map;
+      shape.map_width = atoi(words[1].c_str());
+      shape.map_height = atoi(words[2].c_str());
+      if(shape.map_width < 1 || shape.map_height < 1 || shape.map_width > MAX_MAP_SIDE || shape.map_height > MAX_MAP_SIDE) {
+        snprintf(problem, sizeof(problem), "a map is 1 to %d wide and high", MAX_MAP_SIDE);
+        continue;
+      }
+      shape.map.reserve((size_t)shape.map_width * shape.map_height);
+      for(int row = 0; row < shape.map_height && !problem[0]; row++) {
+        end = at;
+        while(end < length && text[end] != '\n') end++;
+        size_t row_length = end - at;
+        if(row_length && text[end-1] == '\r') row_length--;
+        if(at >= length) {
+          snprintf(problem, sizeof(problem), "a map %d high with %d rows", shape.map_height, row);
+          break;
+        }
+        line++;
+        if(row_length != (size_t)shape.map_width) {
+          snprintf(problem, sizeof(problem), "a row of %d characters in a map %d wide", (int)row_length, shape.map_width);
+        }
+        for(size_t i = 0; i < row_length && !problem[0]; i++) {
+          if(text[at+i] != '#' && text[at+i] != '.') snprintf(problem, sizeof(problem), "'%c' in a map", text[at+i]);
+          shape.map.push_back(text[at+i] == '#');
+        }
+        at = end + 1;
+      }
+    }
+    else {
+      snprintf(problem, sizeof(problem), "don't know '%s' with %d values", words[0].c_str(), (int)words.size() - 1);
+    }
+    if(!problem[0]) found.back().shapes.push_back(shape);
+  }
+  if(!problem[0] && found.empty()) snprintf(problem, sizeof(problem), "no levels in there");
+  if(problem[0]) {
+    char where[32];
+    snprintf(where, sizeof(where), "line %d: ", line);
+    level_error = where;
+    level_error += problem;
+    return false;
+  }
+  into.insert(into.end(), found.begin(), found.end());
+  return true;
+}
+
+int level_count(void) {
+  if(levels.empty()) parse_levels(BUILTIN_LEVEL_TEXT, strlen(BUILTIN_LEVEL_TEXT), levels);
+  return levels.size();
+}
+
+bool load_levels(const char* path) {
+  // adds the levels of a file after the ones there are, false and none of
+  // them if it isn't right
+  level_count();
+  int fd = open(path, O_RDONLY);
+  struct stat info;
+  if(fd == -1 || fstat(fd, &info) == -1) {
+    level_error = strerror(errno);
+    if(fd != -1) close(fd);
+    return false;
+  }
+  size_t size = info.st_size;
+  const char* text = NULL;
+  if(size) text = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(text == MAP_FAILED) {
+    level_error = strerror(errno);
+    return false;
+  }
+  bool good = parse_levels(text, size, levels);
+  if(text) munmap((void*)text, size);
+  return good;
+}
+
+bool level_has_border(int number) {
+  return number >= 0 && number < level_count() && levels[number].has_border;
+}
+
+// compiling ------------------------------------------------------------------
+int fraction_of(int side, int numerator, int denominator) {
+  return (int)((long)side * numerator / denominator);
+}
+
+void draw_shapes(grid& board, const level_spec& spec) {
+  // the walls of a level on an empty board
+  int width = board.width, height = board.height;
+  for(size_t s = 0; s < spec.shapes.size(); s++) {
+    const level_shape& shape = spec.shapes[s];
+    if(shape.kind == shape_border) {
+      for(int x = 1; x <= width; x++) board.set(x, 1, WALL);
+      for(int x = 1; x <= width; x++) board.set(x, height, WALL);
+      for(int y = 1; y <= height; y++) board.set(1, y, WALL);
+      for(int y = 1; y <= height; y++) board.set(width, y, WALL);
+    }
+    else if(shape.kind == shape_rect) {
+      int left = fraction_of(width, shape.numerator[0], shape.denominator[0]);
+      int top = fraction_of(height, shape.numerator[1], shape.denominator[1]);
+      int right = fraction_of(width, shape.numerator[2], shape.denominator[2]);
+      int bottom = fraction_of(height, shape.numerator[3], shape.denominator[3]);
+      for(int y = top + 1; y <= bottom; y++) {
+        for(int x = left + 1; x <= right; x++) board.set(x, y, WALL);
+      }
+    }
+    else {
+      for(int y = 1; y <= height; y++) {
+        const uint8_t* row = &shape.map[(long)(y-1) * shape.map_height / height * shape.map_width];
+        for(int x = 1; x <= width; x++) {
+          if(row[(long)(x-1) * shape.map_width / width]) board.set(x, y, WALL);
+        }
+      }
+    }
+  }
+}
+
+void put_level(grid& board, int number, int width, int height) {
+  // board becomes width by height with the walls of level number and
+  // nothing else. an unknown level has no walls
+  if(number < 0 || number >= level_count()) {
+    board.resize(width, height);
+    return;
+  }
+  level_template* found = NULL;
+  for(size_t i = 0; i < level_cache.size() && !found; i++) {
+    level_template* t = level_cache[i];
+    if(t->number == number && t->board.width == width && t->board.height == height) found = t;
+  }
+  if(!found && (long)width * height <= LEVEL_CACHE_CELLS) {
+    // make room for it, the oldest go first
+    long cells = (long)width * height;
+    for(size_t i = 0; i < level_cache.size(); i++) cells += level_cache[i]->board.size();
+    while(cells > LEVEL_CACHE_CELLS) {
+      cells -= level_cache.front()->board.size();
+      delete level_cache.front();
+      level_cache.erase(level_cache.begin());
+    }
+    found = new level_template;
+    found->number = number;
+    found->board.resize(width, height);
+    draw_shapes(found->board, levels[number]);
+    found->board.forget_changes();
+    level_cache.push_back(found);
+  }
+  if(found) board.copy(found->board);
+  else {
+    board.resize(width, height);
+    draw_shapes(board, levels[number]);
+  }
+}
+
+void forget_levels(void) {
+  // the compiled ones, worm-bench starts over with this
+  for(size_t i = 0; i < level_cache.size(); i++) delete level_cache[i];
+  level_cache.clear();
+}
@@ -0,0 +1,5 @@
+#ifndef WORM_LEVEL_H
+#define WORM_LEVEL_H
+struct level_spec;
+#include "level.cpp"
+#endif
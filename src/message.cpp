@@ -0,0 +1,73 @@
+// a message is a string of bytes, for the network and for snapshots of the
+// game. what goes in is little endian whatever the host is, so messages and
+// the files made of them mean the same everywhere.
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+typedef std::vector<uint8_t> message;
+
+void put_ints(uint8_t* out, const int* values, int count) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(out, values, count*4);
+#else
+  for(int i = 0; i < count; i++) {
+    uint32_t value = (uint32_t)values[i];
+    for(int b = 0; b < 4; b++) out[i*4 + b] = (uint8_t)(value >> (b*8));
+  }
+#endif
+}
+
+void get_ints(const uint8_t* in, int* values, int count) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(values, in, count*4);
+#else
+  for(int i = 0; i < count; i++) {
+    uint32_t value = 0;
+    for(int b = 0; b < 4; b++) value |= (uint32_t)in[i*4 + b] << (b*8);
+    values[i] = (int)value;
+  }
+#endif
+}
+
+void put_shorts(uint8_t* out, const uint16_t* values, int count) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(out, values, count*2);
+#else
+  for(int i = 0; i < count; i++) {
+    out[i*2] = (uint8_t)values[i];
+    out[i*2 + 1] = (uint8_t)(values[i] >> 8);
+  }
+#endif
+}
+
+void get_shorts(const uint8_t* in, uint16_t* values, int count) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(values, in, count*2);
+#else
+  for(int i = 0; i < count; i++) values[i] = (uint16_t)(in[i*2] | in[i*2 + 1] << 8);
+#endif
+}
+
+int get_int(const uint8_t* in) {
+  int value;
+  get_ints(in, &value, 1);
+  return value;
+}
+
+void append_ints(message& buffer, const int* values, int count) {
+  if(count <= 0) return;
+  size_t start = buffer.size();
+  buffer.resize(start + count*4);
+  put_ints(&buffer[start], values, count);
+}
+
+bool read_ints(const message& buffer, size_t& at, int* values, int count) {
+  // false if the message is too short, at is past what was read otherwise
+  if(count <= 0) return true;
+  if(buffer.size() < at + count*4) return false;
+  get_ints(&buffer[at], values, count);
+  at += count*4;
+  return true;
+}
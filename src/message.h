@@ -0,0 +1,4 @@
+#ifndef WORM_MESSAGE_H
+#define WORM_MESSAGE_H
+#include "message.cpp"
+#endif
@@ -0,0 +1,176 @@
+// runs the socket of a network game on a thread of its own, so the game loop
+// never waits for the network. the game and this thread only talk through
+// two queues of messages.
+//
+// messages are framed as network.cpp says. whatever the game queued since
+// the last time goes out with one write. a heartbeat only says that the
+// peer is still there and never reaches the game. over UDP the thread also
+// sends again whatever the peer doesn't acknowledge in time.
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <thread>
+#include <chrono>
+#include <atomic>
+
+#include "network.h"
+#include "spsc.h"
+
+const size_t QUEUE_LENGTH = 256;
+const int HEARTBEAT_MS = 250;
+
+long long steady_ms(void) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class network_thread {
+  public:
+    network_thread(network* conn);
+    ~network_thread(void);
+    // both for the game thread only, false if the queue is full or empty.
+    // a message that doesn't fit would leave the peer behind for good, so
+    // a full queue counts as a lost connection
+    bool send(message& m);
+    bool receive(message& m);
+    bool is_connected(void) const {return connected;}
+    int silent_ms(void) const {return (int)(steady_ms() - last_heard);}
+
+  private:
+    void run(void);
+    bool flush(void);
+    bool fill(void);
+    void deliver(void);
+
+    network* conn;
+    spsc_queue<message> inbox, outbox;
+    std::atomic<bool> running, connected;
+    std::atomic<long long> last_heard;
+    long long last_sent;
+    message pending;          // bytes read but not handed to the game yet
+    size_t pending_used;
+    message incoming, outgoing;
+    message sending;          // framed messages for one write
+    int wake[2];              // a pipe to get us out of poll() for sending
+    std::thread worker;
+};
+
+network_thread::network_thread(network* conn) : inbox(QUEUE_LENGTH), outbox(QUEUE_LENGTH) {
+  this->conn = conn;
+  running = true;
+  connected = conn->is_connected;
+  last_heard = steady_ms();
+  last_sent = 0;
+  pending_used = 0;
+  if(pipe(wake) == -1) error("pipe");
+  fcntl(wake[0], F_SETFL, O_NONBLOCK);
+  fcntl(wake[1], F_SETFL, O_NONBLOCK);
+  worker = std::thread(&network_thread::run, this);
+}
+
+network_thread::~network_thread(void) {
+  running = false;
+  char byte = 0;
+  if(write(wake[1], &byte, 1)) {}
+  worker.join();
+  close(wake[0]);
+  close(wake[1]);
+}
+
+bool network_thread::send(message& m) {
+  if(!outbox.push(m)) {
+    connected = false;
+    return false;
+  }
+  // a full pipe already has the thread awake
+  char byte = 0;
+  if(write(wake[1], &byte, 1)) {}
+  return true;
+}
+
+bool network_thread::receive(message& m) {
+  return inbox.pop(m);
+}
+
+void network_thread::run(void) {
+  while(running && connected) {
+    // don't read while the game hasn't taken what we already have
+    deliver();
+    bool stuck = (pending_used < pending.size() && inbox.full());
+    struct pollfd fds[2];
+    fds[0].fd = conn->fd;
+    fds[0].events = stuck ? 0 : POLLIN;
+    fds[1].fd = wake[0];
+    fds[1].events = POLLIN;
+    int timeout = stuck ? 5 : HEARTBEAT_MS / 2;
+    int due = conn->timer_ms();
+    if(due >= 0 && due < timeout) timeout = due;
+    if(!stuck && conn->buffered()) timeout = 0;
+    poll(fds, 2, timeout);
+    if(fds[1].revents) {
+      char bytes[64];
+      while(read(wake[0], bytes, sizeof(bytes)) > 0) {}
+    }
+    if(!flush() || !conn->service()) break;
+    if((fds[0].revents || (!stuck && conn->buffered())) && !fill()) break;
+  }
+  connected = false;
+}
+
+bool network_thread::flush(void) {
+  // send all the game handed us, or a heartbeat if that was a while ago
+  sending.clear();
+  while(outbox.pop(outgoing)) {
+    int length = outgoing.size();
+    append_ints(sending, &length, 1);
+    sending.insert(sending.end(), outgoing.begin(), outgoing.end());
+  }
+  if(sending.empty() && steady_ms() - last_sent >= HEARTBEAT_MS) {
+    int length = 0;
+    append_ints(sending, &length, 1);
+  }
+  if(sending.empty()) return true;
+  last_sent = steady_ms();
+  return conn->write_all(sending.data(), sending.size());
+}
+
+bool network_thread::fill(void) {
+  // read whatever arrived, poll() said it won't block
+  if(pending_used == pending.size()) {
+    pending.clear();
+    pending_used = 0;
+  }
+  size_t start = pending.size();
+  pending.resize(start + 65536);
+  ssize_t got = conn->read_some(&pending[start], 65536);
+  pending.resize(start + (got > 0 ? got : 0));
+  if(got < 0) return false; // EOF or error, the peer is gone
+  // over UDP maybe only an acknowledgement, the heartbeats say more
+  if(got) last_heard = steady_ms();
+  deliver();
+  return true;
+}
+
+void network_thread::deliver(void) {
+  // hand every complete message to the game, as long as there is room
+  while(pending.size() - pending_used >= 4) {
+    int length = get_int(&pending[pending_used]);
+    if(length < 0 || length > MAX_MESSAGE) {
+      connected = false;
+      return;
+    }
+    if(pending.size() - pending_used - 4 < (size_t)length) break;
+    if(length) {
+      if(inbox.full()) break;
+      incoming.assign(&pending[pending_used + 4], &pending[pending_used + 4] + length);
+      inbox.push(incoming);
+    }
+    pending_used += 4 + length;
+  }
+  // keep the buffer from growing with a long stream of small messages
+  if(pending_used > 65536) {
+    pending.erase(pending.begin(), pending.begin() + pending_used);
+    pending_used = 0;
+  }
+}
@@ -0,0 +1,5 @@
+#ifndef WORM_NETTHREAD_H
+#define WORM_NETTHREAD_H
+class network_thread;
+#include "netthread.cpp"
+#endif
@@ -1,10 +1,37 @@
+// the connection between two games, or a game and a dedicated server. both
+// ends first send a hello of PROTOCOL_MAGIC and PROTOCOL_VERSION and give up
+// on a peer that says anything else. after that everything is a message:
+// its length as an int and that many bytes, ints little endian. a message
+// of length 0 is a heartbeat.
+//
+// a client may ask for UDP instead (see udp.cpp), the host listens for both
+// on the same port and takes whoever comes first. the bytes are the same.
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
+#include <vector>
+
+#include "grid.h"
+#include "message.h"
+#include "udp.h"
+
+const int PROTOCOL_MAGIC = 0x4d524f57;  // "WORM"
+const int PROTOCOL_VERSION = 2;  // 2: the host tells the size of the board, not of a screen
+const int MAX_MESSAGE = 64 << 20;       // anything longer is garbage, not a message
+
+// frames of the playground sync
+const int KEYFRAME = 1;           // followed by every cell
+const int DELTA = 2;              // followed by (position, cell) pairs
 
 void error(const char *msg)
 {
@@ -16,31 +43,54 @@ class network {
   public:
     network(void);
     ~network(void);
-    void send_input(int, int);
-    void send_playground(int*, int max_x, int max_y);
-    void send_int(int score);
-    void receive_playground(int*, int max_x, int max_y);
-    void receive_input(int &mov_x, int &mov_y);
-    void receive_int(int &score);
+    bool hello(void);
+    bool send_message(const message& m);
+    bool receive_message(message& m);
+    bool write_all(const void* buffer, size_t length);
+    bool read_all(void* buffer, size_t length);
+    // for the network thread: what arrived without waiting, -1 if the peer is
+    // gone. and for UDP, when to call service() to send again what got lost
+    ssize_t read_some(void* buffer, size_t length);
+    size_t buffered(void) const {return link ? link->buffered() : 0;}
+    int timer_ms(void) const {return link ? link->timer_ms() : -1;}
+    bool service(void);
 
     bool is_connected;
+    udp_link* link;               // NULL for TCP
+    message framed;               // what send_message() gives link
     struct addrinfo hints;
     struct addrinfo *result;
     int s, fd;
-    char port[5];
+    char port[6];
 };
 
 class server : public network {
   public:
     server(char* p);
+
+  private:
+    bool accept_datagram(int datagrams);
 };
 
 class client : public network {
   public:
-    client(char* p, char* ip);
+    client(char* p, char* ip, bool udp = false);
     char server_ip_hostname[20];
+
+  private:
+    bool connect_datagrams(void);
 };
 
+void set_nodelay(int fd) {
+  // a tick is one write, waiting to fill a packet only makes it late
+  int yes = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+}
+
+int set_nonblocking(int fd) {
+  return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+}
+
 network::network(void) {
   memset (&hints, 0, sizeof (struct addrinfo));
   hints.ai_family = AF_UNSPEC;    /* Allow IPv4 or IPv6 */
@@ -50,14 +100,18 @@ network::network(void) {
   hints.ai_canonname = NULL;
   hints.ai_addr = NULL;
   hints.ai_next = NULL;
+  is_connected = false;
+  link = NULL;
 }
 
 network::~network(void) {
+  delete link;
   close (fd);
 }
 
 server::server(char* p) {
   strncpy (this->port, p, 5);
+  this->port[5] = '\0';
   s = getaddrinfo (NULL, this->port, &hints, &result);
   //s = getaddrinfo (NULL, "4567", &hints, &result);
   if (s != 0)	{
@@ -75,21 +129,58 @@ server::server(char* p) {
     perror ("socket/bind");
     exit (1);
   }
+  // the same port for a client that asks for UDP, TCP alone will do as well
+  int datagrams = socket (r->ai_family, SOCK_DGRAM, 0);
+  if (datagrams != -1 && bind (datagrams, r->ai_addr, r->ai_addrlen) == -1) {
+    close (datagrams);
+    datagrams = -1;
+  }
   freeaddrinfo (result);
   if (listen (fd, 1) == -1) {
     perror ("listen");
     exit (1);
   }
-  if ((fd = accept (fd, NULL, NULL)) == -1) {
-    perror ("error");
-    exit (1);
+  int listening = fd;
+  fd = -1;
+  while (fd == -1) {
+    struct pollfd ready[2] = {{listening, POLLIN, 0}, {datagrams, POLLIN, 0}};
+    if (poll (ready, datagrams == -1 ? 1 : 2, -1) == -1) continue;
+    if (ready[0].revents) {
+      if ((fd = accept (listening, NULL, NULL)) == -1) {
+        perror ("error");
+        exit (1);
+      }
+      set_nodelay(fd);
+    }
+    else if (ready[1].revents && accept_datagram (datagrams)) fd = datagrams;
   }
+  close (listening);
+  if (!link && datagrams != -1) close (datagrams);
   is_connected = true;
 }
 
-client::client(char* p, char* ip) {
+bool server::accept_datagram(int datagrams) {
+  // the first UDP_CONNECT makes its sender our peer, anything else is noise
+  uint8_t packet[UDP_PACKET];
+  struct sockaddr_storage from;
+  socklen_t length = sizeof(from);
+  ssize_t got = recvfrom (datagrams, packet, sizeof(packet), 0, (struct sockaddr*)&from, &length);
+  if (got <= 0 || !udp_link::is_connect (packet, got)) return false;
+  if (connect (datagrams, (struct sockaddr*)&from, length) == -1) return false;
+  link = new udp_link (datagrams, true);
+  return true;
+}
+
+client::client(char* p, char* ip, bool udp) {
   strncpy (this->port, p, 5);
+  this->port[5] = '\0';
   strncpy (this->server_ip_hostname, ip, 20);
+  this->server_ip_hostname[19] = '\0';
+  // UDP if asked for and the host answers, TCP otherwise
+  if (udp && connect_datagrams ()) {
+    is_connected = true;
+    return;
+  }
   s = getaddrinfo (this->server_ip_hostname, this->port, &hints, &result);
   //s = getaddrinfo ("localhost", "4567", &hints, &result);
   if (s != 0) exit (1);
@@ -102,31 +193,191 @@ client::client(char* p, char* ip) {
   }
   if (!r) exit (1);
   freeaddrinfo (result);
+  set_nodelay(fd);
   is_connected = true;
 }
 
-void network::send_input(int input_x, int input_y) {
-  write (fd, &input_x, 4);
-  write (fd, &input_y, 4);
+bool client::connect_datagrams(void) {
+  // try every address of the host, a refused one costs no time
+  hints.ai_socktype = SOCK_DGRAM;
+  s = getaddrinfo (this->server_ip_hostname, this->port, &hints, &result);
+  hints.ai_socktype = SOCK_STREAM;
+  if (s != 0) return false;
+  for (struct addrinfo *r = result; r != NULL && !link; r = r->ai_next) {
+    fd = socket (r->ai_family, r->ai_socktype, r->ai_protocol);
+    if (fd == -1) continue;
+    if (connect (fd, r->ai_addr, r->ai_addrlen) == 0) {
+      link = new udp_link (fd, false);
+      if (link->connect_to_host ()) break;
+      delete link;
+      link = NULL;
+    }
+    close (fd);
+  }
+  freeaddrinfo (result);
+  return link != NULL;
 }
 
-void network::receive_input(int &input_x, int &input_y) {
-  read (fd, &input_x, 4);
-  read (fd, &input_y, 4);
+bool network::write_all(const void* buffer, size_t length) {
+  // write() may take less than we asked for, keep going until all is out
+  if(link) return is_connected = is_connected && link->send((const uint8_t*)buffer, length);
+  const char* next = (const char*)buffer;
+  while(is_connected && length > 0) {
+    ssize_t written = send (fd, next, length, MSG_NOSIGNAL);
+    if(written <= 0) is_connected = false;
+    else {
+      next += written;
+      length -= written;
+    }
+  }
+  return is_connected;
 }
 
-void network::send_int(int score) {
-  write (fd, &score, 4);
+bool network::read_all(void* buffer, size_t length) {
+  // the same for read(), a frame may arrive in several pieces
+  char* next = (char*)buffer;
+  while(is_connected && length > 0) {
+    ssize_t got = link ? link->receive((uint8_t*)next, length) : read (fd, next, length);
+    if(got < 0 || (got == 0 && !link)) is_connected = false;
+    else if(got == 0 && !link->wait(UDP_POLL_MS)) is_connected = false;
+    else {
+      next += got;
+      length -= got;
+    }
+  }
+  return is_connected;
 }
 
-void network::receive_int(int &score) {
-  read (fd, &score, 4);
+ssize_t network::read_some(void* buffer, size_t length) {
+  ssize_t got = link ? link->receive((uint8_t*)buffer, length) : read (fd, buffer, length);
+  if(got < 0 || (got == 0 && !link)) {
+    is_connected = false;
+    return -1;
+  }
+  return got;
 }
 
-void network::send_playground(int* pground, int max_x, int max_y) {
-  write (fd, pground, max_x*max_y*4);
+bool network::service(void) {
+  if(link && !link->service()) is_connected = false;
+  return is_connected;
 }
 
-void network::receive_playground(int* pground, int max_x, int max_y) {
-  read (fd, pground, max_x*max_y*4);
+bool network::send_message(const message& m) {
+  // the length and the message with one call, TCP_NODELAY sends them at once
+  uint8_t length[4];
+  int size = (int)m.size();
+  put_ints(length, &size, 1);
+  if(link) {
+    // and one segment, one packet
+    framed.assign(length, length + 4);
+    framed.insert(framed.end(), m.begin(), m.end());
+    return write_all(framed.data(), framed.size());
+  }
+  struct iovec parts[2];
+  parts[0].iov_base = length;
+  parts[0].iov_len = 4;
+  parts[1].iov_base = (void*)m.data();
+  parts[1].iov_len = m.size();
+  struct msghdr header;
+  memset(&header, 0, sizeof(header));
+  header.msg_iov = parts;
+  header.msg_iovlen = m.empty() ? 1 : 2;
+  ssize_t written = is_connected ? sendmsg(fd, &header, MSG_NOSIGNAL) : -1;
+  if(written < 0) {
+    is_connected = false;
+    return false;
+  }
+  // a full socket takes only the beginning, the rest goes the slow way
+  if(written < 4) return write_all(length + written, 4 - written) && write_all(m.data(), m.size());
+  return write_all(m.data() + (written - 4), m.size() - (written - 4));
+}
+
+bool network::receive_message(message& m) {
+  // the next message that isn't a heartbeat
+  do {
+    uint8_t length[4];
+    if(!read_all(length, 4)) return false;
+    int size = get_int(length);
+    if(size < 0 || size > MAX_MESSAGE) is_connected = false;
+    m.resize(size > 0 ? size : 0);
+    if(size > 0 && !read_all(&m[0], size)) return false;
+  } while(is_connected && m.empty());
+  return is_connected;
+}
+
+bool network::hello(void) {
+  // before anything else, false if the other end doesn't speak our protocol
+  int ours[2] = {PROTOCOL_MAGIC, PROTOCOL_VERSION}, theirs[2];
+  message greeting;
+  append_ints(greeting, ours, 2);
+  size_t at = 0;
+  if(!send_message(greeting) || !receive_message(greeting)) return false;
+  if(!read_ints(greeting, at, theirs, 2) || theirs[0] != ours[0] || theirs[1] != ours[1]) {
+    is_connected = false;
+  }
+  return is_connected;
+}
+
+// a changed cell in a delta is its position and the cell
+const size_t CELL_BYTES = sizeof(cellvalue);
+const size_t CHANGE_BYTES = 4 + CELL_BYTES;
+
+bool keyframe_is_cheaper(grid& pground) {
+  return pground.change_count * CHANGE_BYTES >= pground.size() * CELL_BYTES;
+}
+
+void encode_playground(grid& pground, bool keyframe, std::vector<uint8_t>& frame) {
+  // append a frame to what's in frame already. a frame is a type and a count
+  // followed by every cell (keyframe) or by the changed cells (delta)
+  int header[2];
+  size_t start = frame.size();
+  if(keyframe) {
+    header[0] = KEYFRAME;
+    header[1] = pground.size();
+    frame.resize(start + sizeof(header) + pground.size() * CELL_BYTES);
+    put_shorts(&frame[start + sizeof(header)], pground.cells, pground.size());
+  }
+  else {
+    header[0] = DELTA;
+    header[1] = pground.change_count;
+    frame.resize(start + sizeof(header) + pground.change_count * CHANGE_BYTES);
+    uint8_t* next = &frame[start + sizeof(header)];
+    for(int i = 0; i < pground.change_count; i++) {
+      int pos = pground.changes[i];
+      cellvalue cell = pground[pos];
+      put_ints(next, &pos, 1);
+      put_shorts(next + 4, &cell, 1);
+      next += CHANGE_BYTES;
+    }
+  }
+  put_ints(&frame[start], header, 2);
+}
+
+bool apply_playground(grid& pground, const message& buffer, size_t& at) {
+  // apply a frame from a message to the playground, it notes the changed
+  // cells itself. false if the frame is broken
+  int header[2];
+  if(!read_ints(buffer, at, header, 2)) return false;
+  int count = header[1];
+  if(count < 0 || count > pground.size() || (header[0] != KEYFRAME && header[0] != DELTA)) return false;
+  size_t length = (size_t)count * ((header[0]==KEYFRAME) ? CELL_BYTES : CHANGE_BYTES);
+  if(buffer.size() < at + length) return false;
+  const uint8_t* data = &buffer[at];
+  at += length;
+  cellvalue cell;
+  if(header[0]==KEYFRAME) {
+    for(int pos = 0; pos < count; pos++) {
+      get_shorts(&data[pos * CELL_BYTES], &cell, 1);
+      pground.set(pos, cell);
+    }
+  }
+  else {
+    for(int i = 0; i < count; i++) {
+      int pos = get_int(&data[i * CHANGE_BYTES]);
+      get_shorts(&data[i * CHANGE_BYTES + 4], &cell, 1);
+      if(pos < 0 || pos >= pground.size()) continue;
+      pground.set(pos, cell);
+    }
+  }
+  return true;
 }
@@ -1,3 +1,5 @@
+#ifndef WORM_NETWORK_H
+#define WORM_NETWORK_H
 class network;
 #include "network.cpp"
-
+#endif
@@ -0,0 +1,163 @@
+// where the time of a tick goes. PROFILE(phase) at the top of a block times
+// the block into a histogram of that phase, and with a trace running also
+// into a ring of the last TRACE_EVENTS blocks, which write_trace() saves in
+// the trace event format of chrome://tracing. only the thread that runs the
+// game may time anything. built with WORM_NO_PROFILER ("make PROFILER=off")
+// PROFILE() is nothing at all.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+
+enum phases {phase_tick, phase_think, phase_move, phase_food, phase_spawn,
+             phase_collisions, phase_network, phase_draw, phase_round, PHASES};
+const char* PHASE_NAMES[PHASES] = {"tick", "think", "move", "food", "spawn",
+                                   "collide", "network", "draw", "round"};
+
+// durations in ns. below 4 every ns has a bucket, above that every power of
+// two is split into four, so a percentile is off by at most a quarter
+const int HISTOGRAM_BUCKETS = 256;
+const size_t TRACE_EVENTS = 1 << 18;
+
+class histogram {
+  public:
+    histogram(void) {clear();}
+    void clear(void);
+    void add(long long ns);
+    long long percentile(double p) const; // the most it can be, in ns
+    long count(void) const {return total;}
+
+  private:
+    static int bucket_of(long long ns);
+    static long long highest_in(int bucket);
+
+    long counts[HISTOGRAM_BUCKETS];
+    long total;
+};
+
+void histogram::clear(void) {
+  memset(counts, 0, sizeof(counts));
+  total = 0;
+}
+
+int histogram::bucket_of(long long ns) {
+  if(ns < 4) return ns < 0 ? 0 : (int)ns;
+  int power = 63 - __builtin_clzll((unsigned long long)ns);
+  return 4 * (power - 1) + (int)((ns >> (power - 2)) & 3);
+}
+
+long long histogram::highest_in(int bucket) {
+  if(bucket < 4) return bucket;
+  int power = bucket / 4 + 1;
+  long long lowest = (long long)(4 + bucket % 4) << (power - 2);
+  return lowest + (1LL << (power - 2)) - 1;
+}
+
+void histogram::add(long long ns) {
+  counts[bucket_of(ns)]++;
+  total++;
+}
+
+long long histogram::percentile(double p) const {
+  long wanted = (long)(p / 100 * total + 0.5);
+  if(wanted < 1) wanted = 1;
+  long seen = 0;
+  for(int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+    seen += counts[b];
+    if(seen >= wanted) return highest_in(b);
+  }
+  return 0;
+}
+
+class profiler {
+  public:
+    profiler(void);
+    void record(int phase, std::chrono::steady_clock::time_point start,
+                std::chrono::steady_clock::time_point end);
+    void clear(void);
+    void start_trace(void);
+    bool write_trace(const char* path) const;
+
+    histogram phase[PHASES];
+
+  private:
+    struct event {
+      int phase;
+      long long start, ns;       // since the profiler was made
+    };
+    std::chrono::steady_clock::time_point origin;
+    std::vector<event> trace;    // a ring once it is full
+    size_t traced;               // events ever put in
+};
+
+profiler::profiler(void) {
+  origin = std::chrono::steady_clock::now();
+  traced = 0;
+}
+
+void profiler::record(int phase, std::chrono::steady_clock::time_point start,
+                      std::chrono::steady_clock::time_point end) {
+  long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+  this->phase[phase].add(ns);
+  if(trace.empty()) return;
+  event& e = trace[traced++ % trace.size()];
+  e.phase = phase;
+  e.start = std::chrono::duration_cast<std::chrono::nanoseconds>(start - origin).count();
+  e.ns = ns;
+}
+
+void profiler::clear(void) {
+  for(int p = 0; p < PHASES; p++) phase[p].clear();
+}
+
+void profiler::start_trace(void) {
+  // all the room at once, tracing doesn't allocate while the game runs
+  trace.resize(TRACE_EVENTS);
+  traced = 0;
+}
+
+bool profiler::write_trace(const char* path) const {
+  // complete events, in microseconds, oldest first
+  FILE* out = fopen(path, "w");
+  if(!out) return false;
+  fprintf(out, "{\"traceEvents\": [");
+  size_t kept = traced < trace.size() ? traced : trace.size();
+  for(size_t i = traced - kept; i < traced; i++) {
+    const event& e = trace[i % trace.size()];
+    fprintf(out, "%s\n  {\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, "
+                 "\"ts\": %.3f, \"dur\": %.3f}", i > traced - kept ? "," : "",
+            PHASE_NAMES[e.phase], e.start / 1000.0, e.ns / 1000.0);
+  }
+  fprintf(out, "\n], \"displayTimeUnit\": \"ns\"}\n");
+  return fclose(out) == 0;
+}
+
+profiler profile;
+
+class profile_scope {
+  public:
+    profile_scope(int phase) {
+      this->phase = phase;
+      start = std::chrono::steady_clock::now();
+    }
+    ~profile_scope(void) {profile.record(phase, start, std::chrono::steady_clock::now());}
+
+  private:
+    int phase;
+    std::chrono::steady_clock::time_point start;
+};
+
+#ifdef WORM_NO_PROFILER
+#define PROFILE(phase)
+#else
+#define PROFILE(phase) profile_scope profile_##phase(phase)
+#endif
+
+const char* trace_file = NULL;   // --trace, written by finish_trace()
+
+void finish_trace(void) {
+  if(trace_file && !profile.write_trace(trace_file)) perror(trace_file);
+  trace_file = NULL;
+}
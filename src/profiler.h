@@ -0,0 +1,7 @@
+#ifndef WORM_PROFILER_H
+#define WORM_PROFILER_H
+class histogram;
+class profiler;
+class profile_scope;
+#include "profiler.cpp"
+#endif
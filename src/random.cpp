@@ -0,0 +1,40 @@
+// random numbers for the simulation. unlike rand() the sequence depends on
+// nothing but the seed, so two peers seeded alike spawn the same food on the
+// same tick. xorshift64* seeded through splitmix64.
+
+#include <stdint.h>
+
+class prng {
+  public:
+    prng(uint64_t seed = 1) {this->seed(seed);}
+    void seed(uint64_t seed);
+    uint32_t next(void);
+    int below(int n); // 0 <= result < n
+    uint64_t save(void) const {return state;}
+    void restore(uint64_t saved) {if(saved) state = saved;}
+
+  private:
+    uint64_t state;
+};
+
+void prng::seed(uint64_t seed) {
+  // splitmix64 spreads close seeds apart and never yields the zero state
+  // xorshift can't leave
+  uint64_t z = seed + 0x9e3779b97f4a7c15ULL;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  state = z ^ (z >> 31);
+  if(!state) state = 0x9e3779b97f4a7c15ULL;
+}
+
+uint32_t prng::next(void) {
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return (uint32_t)((state * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+int prng::below(int n) {
+  // scale instead of %, no division and no bias worth mentioning
+  return (int)(((uint64_t)next() * (uint32_t)n) >> 32);
+}
@@ -0,0 +1,5 @@
+#ifndef WORM_RANDOM_H
+#define WORM_RANDOM_H
+class prng;
+#include "random.cpp"
+#endif
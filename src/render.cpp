@@ -0,0 +1,351 @@
+// drawing the playground on the terminal, either through ncurses or with
+// escape sequences of our own. ncurses keeps a copy of the screen and works
+// out what to send for every cell that was touched, the ANSI renderer knows
+// which cells changed from the playground and puts the whole frame into one
+// buffer: a colour only where it changes along the way, the cursor moved
+// only where it doesn't get there by writing, and a single write() at the
+// end. everything around the playground stays with ncurses, the frame saves
+// and restores the cursor and its colours so ncurses never notices.
+
+#include <curses.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <vector>
+#include <algorithm>
+
+#include "game.h"
+
+const int PLAYER_COLOURS = 5;
+const int BLANK_RUN = 8;  // from here on a run of blanks is erased, not written
+
+// colour pairs ---------------------------------------------------------------
+struct colour_pair {short id, characters, background;};
+const colour_pair COLOUR_PAIRS[] = {
+  {WALL, COLOR_BLUE, COLOR_WHITE},
+  {FOOD, COLOR_WHITE, COLOR_BLUE},
+  // the players, one after the other
+  {WORMHEAD+10, COLOR_BLACK, COLOR_YELLOW}, {WORM+10, COLOR_CYAN, COLOR_YELLOW},
+  {WORMHEAD+20, COLOR_BLACK, COLOR_GREEN},  {WORM+20, COLOR_CYAN, COLOR_GREEN},
+  {WORMHEAD+30, COLOR_BLACK, COLOR_MAGENTA}, {WORM+30, COLOR_CYAN, COLOR_MAGENTA},
+  {WORMHEAD+40, COLOR_BLACK, COLOR_CYAN},   {WORM+40, COLOR_BLUE, COLOR_CYAN},
+  {WORMHEAD+50, COLOR_BLACK, COLOR_RED},    {WORM+50, COLOR_CYAN, COLOR_RED},
+  // level backgrounds
+  {9, COLOR_WHITE, COLOR_BLACK},
+  {8, COLOR_BLACK, COLOR_WHITE},
+  // menu colors
+  {10, COLOR_WHITE, COLOR_BLACK},
+  {11, COLOR_BLACK, COLOR_WHITE},
+};
+const int COLOUR_PAIR_COUNT = sizeof(COLOUR_PAIRS) / sizeof(COLOUR_PAIRS[0]);
+const int MAX_PAIR = 64;
+
+int background_pair;      // of the playground, see set_level_colours()
+
+void init_colour_pairs(void) {
+  for(int i = 0; i < COLOUR_PAIR_COUNT; i++) {
+    init_pair(COLOUR_PAIRS[i].id, COLOUR_PAIRS[i].characters, COLOUR_PAIRS[i].background);
+  }
+}
+
+struct cell_look {
+  int pair;
+  const char* text;       // two characters, a cell is two wide on screen
+};
+
+cell_look look_of(int pos) {
+  cellvalue cell = playground[pos];
+  int number = cell_player(cell);
+  int colour = (number-1) % PLAYER_COLOURS + 1;
+  player* owner = (number >= 1 && number <= (int)players.size()) ? players[number-1] : NULL;
+  cell_look look = {background_pair, "  "};
+  switch(cell_kind(cell)) {
+    case WALL:
+      look.pair = level_has_border(level) ? WALL : 9;
+      break;
+    case WORMHEAD:
+      look.pair = WORMHEAD + colour*10;
+      if(!owner) break;
+      if(owner->move_x==1) look.text = ": ";
+      if(owner->move_x==-1) look.text = " :";
+      if(owner->move_y) look.text = "..";
+      break;
+    case WORM:
+      look.pair = WORM + colour*10;
+      break;
+    case FOOD:
+      look.pair = FOOD;
+      break;
+  }
+  return look;
+}
+
+// the renderers --------------------------------------------------------------
+class renderer {
+  public:
+    renderer(void) : on_top(NULL), view_x(0), view_y(0) {}
+    virtual ~renderer(void) {}
+    // the part of the playground in view into window, all of it or the
+    // cells that changed since the last frame, and out to the terminal.
+    // moving the view takes all of it
+    virtual void draw(WINDOW* window, bool everything) = 0;
+
+    WINDOW* on_top;       // a menu over the playground, or NULL
+    int view_x, view_y;   // the column and row of the board at the top left, from 0
+};
+
+class curses_renderer : public renderer {
+  public:
+    void draw(WINDOW* window, bool everything);
+
+  private:
+    void draw_cell(WINDOW* window, int pos);
+
+    int rows, columns;    // of the board, that are in view
+    int width;            // of the window, the last cell may only fit half
+};
+
+void curses_renderer::draw(WINDOW* window, bool everything) {
+  // usually only the cells that changed this tick are drawn again. after a
+  // resize or a menu on top of the game the whole screen needs repainting
+  getmaxyx(window, rows, width);
+  rows = std::min(rows, play_y - view_y);
+  columns = std::min((width + 1) / 2, play_x - view_x);
+  if(everything) {
+    clear();
+    refresh();
+    wclear(window);
+    for(int y = 0; y < rows; y++) {
+      int pos = (view_y + y) * play_x + view_x;
+      for(int x = 0; x < columns; x++, pos++) {
+        if(playground[pos]) draw_cell(window, pos);
+      }
+    }
+  }
+  else {
+    for(int i = 0; i < playground.change_count; i++) {
+      draw_cell(window, playground.changes[i]);
+    }
+  }
+  // until now nothing was updated
+  wrefresh(window);
+}
+
+void curses_renderer::draw_cell(WINDOW* window, int pos) {
+  int y = pos / play_x - view_y, x = pos % play_x - view_x;
+  if(y < 0 || y >= rows || x < 0 || x >= columns) return;
+  cell_look look = look_of(pos);
+  wcolor_set(window, look.pair, 0);
+  mvwaddnstr(window, y, x * 2, look.text, std::min(2, width - x * 2));
+}
+
+class ansi_renderer : public renderer {
+  public:
+    ansi_renderer(int fd);
+    void draw(WINDOW* window, bool everything);
+    static bool fits_terminal(void);
+
+    long bytes;                   // written so far
+
+  private:
+    void move_to(int row, int column);
+    void use_pair(int pair);
+    void paint_row(int y, int from, int to);
+    void put_part(int pos, cell_look look, int from, int to);
+    void spaces(int y, int x, int count, int colour);
+    void put(const char* text, size_t length);
+    void put_number(int number);
+
+    int fd;
+    bool erases_in_colour;        // the terminal erases with the background colour
+    char colours[MAX_PAIR][24];   // the escape sequence of each pair
+    std::vector<char> frame;      // grows to the biggest frame, then stays
+    size_t used;
+    std::vector<int> cells;       // the changes in the order of the screen
+    int top, left, rows, columns; // of the window, as far as the board goes
+    int row, column, pair;        // where the terminal is at, -1 for don't know
+    int cover_top, cover_bottom, cover_left, cover_right;
+    int cleared_pair;             // what the screen was cleared with this frame, or -1
+};
+
+ansi_renderer::ansi_renderer(int fd) {
+  this->fd = fd;
+  bytes = 0;
+  used = 0;
+  erases_in_colour = tigetflag((char*)"bce") > 0;
+  memset(colours, 0, sizeof(colours));
+  for(int i = 0; i < COLOUR_PAIR_COUNT; i++) {
+    const colour_pair& p = COLOUR_PAIRS[i];
+    snprintf(colours[p.id], sizeof(colours[p.id]), "\033[3%d;4%dm", p.characters, p.background);
+  }
+}
+
+bool ansi_renderer::fits_terminal(void) {
+  // if it moves the cursor like that, it takes the rest of ours as well
+  const char* cup = tigetstr((char*)"cup");
+  return cup && cup != (char*)-1 && !strncmp(cup, "\033[", 2) && has_colors();
+}
+
+void ansi_renderer::draw(WINDOW* window, bool everything) {
+  cleared_pair = -1;
+  if(everything) {
+    // anything that was on the screen goes
+    clear();
+    refresh();
+    cleared_pair = PAIR_NUMBER(getbkgd(stdscr));
+  }
+  getbegyx(window, top, left);
+  getmaxyx(window, rows, columns);
+  rows = std::min(rows, play_y - view_y);
+  columns = std::min(columns, (play_x - view_x) * 2);
+  // the part of the window a menu hides, ncurses looks after that
+  cover_top = cover_bottom = cover_left = cover_right = 0;
+  if(on_top) {
+    getbegyx(on_top, cover_top, cover_left);
+    getmaxyx(on_top, cover_bottom, cover_right);
+    cover_top -= top;
+    cover_left -= left;
+    cover_bottom += cover_top;
+    cover_right += cover_left;
+  }
+  // nothing here gets longer than this
+  size_t cells_drawn = everything ? (size_t)rows * (columns / 2 + 2) : playground.change_count;
+  size_t most = cells_drawn * 32 + 64;
+  if(frame.size() < most) frame.resize(most);
+  used = 0;
+  row = column = pair = -1;
+  put("\0337\033[0m", 6);
+
+  if(everything) {
+    // row after row, the empty cells together
+    for(int y = 0; y < rows; y++) {
+      if(y >= cover_top && y < cover_bottom) {
+        paint_row(y, 0, std::min(columns, cover_left));
+        paint_row(y, std::max(0, cover_right), columns);
+      }
+      else paint_row(y, 0, columns);
+    }
+  }
+  else {
+    cells.assign(playground.changes, playground.changes + playground.change_count);
+    std::sort(cells.begin(), cells.end());
+    for(size_t i = 0; i < cells.size(); i++) {
+      int y = cells[i] / play_x - view_y, x = (cells[i] % play_x - view_x) * 2;
+      if(y < 0 || y >= rows || x < 0 || x >= columns) continue;
+      cell_look look = look_of(cells[i]);
+      if(y >= cover_top && y < cover_bottom && x + 2 > cover_left && x < cover_right) {
+        put_part(cells[i], look, 0, cover_left);
+        put_part(cells[i], look, cover_right, columns);
+      }
+      else put_part(cells[i], look, 0, columns);
+    }
+  }
+
+  put("\0338", 2);
+  // out in one go, unless the terminal takes less at a time
+  size_t done = 0;
+  while(done < used) {
+    ssize_t wrote = write(fd, &frame[done], used - done);
+    if(wrote < 0 && errno == EINTR) continue;
+    if(wrote <= 0) break;
+    done += wrote;
+  }
+  bytes += done;
+}
+
+void ansi_renderer::put(const char* text, size_t length) {
+  memcpy(&frame[used], text, length);
+  used += length;
+}
+
+void ansi_renderer::put_number(int number) {
+  char digits[12];
+  int count = 0;
+  do {
+    digits[count++] = '0' + number % 10;
+    number /= 10;
+  } while(number);
+  while(count) frame[used++] = digits[--count];
+}
+
+void ansi_renderer::move_to(int y, int x) {
+  // y and x in the window. right on the same row is shorter than anywhere
+  if(y == row && x == column) return;
+  if(y == row && x > column) {
+    put("\033[", 2);
+    if(x - column > 1) put_number(x - column);
+    put("C", 1);
+  }
+  else {
+    put("\033[", 2);
+    put_number(top + y + 1);
+    put(";", 1);
+    put_number(left + x + 1);
+    put("H", 1);
+  }
+  row = y;
+  column = x;
+}
+
+void ansi_renderer::use_pair(int next) {
+  if(next == pair) return;
+  put(colours[next], strlen(colours[next]));
+  pair = next;
+}
+
+void ansi_renderer::paint_row(int y, int from, int to) {
+  // the characters from to to of a row. cells of nothing but spaces in one
+  // colour go together, empty ones and walls mostly
+  int run = 0, run_start = from, run_pair = -1;
+  for(int x = from; x < to; x = (x / 2 + 1) * 2) {
+    int pos = (view_y + y) * play_x + view_x + x / 2;
+    int end = std::min(to, (x / 2 + 1) * 2);
+    cell_look look = {background_pair, "  "};
+    if(playground[pos]) look = look_of(pos);
+    if(look.text[0] == ' ' && look.text[1] == ' ') {
+      if(run && look.pair != run_pair) {
+        spaces(y, run_start, run, run_pair);
+        run = 0;
+      }
+      if(!run) {
+        run_start = x;
+        run_pair = look.pair;
+      }
+      run += end - x;
+      continue;
+    }
+    spaces(y, run_start, run, run_pair);
+    run = 0;
+    put_part(pos, look, x, end);
+  }
+  spaces(y, run_start, run, run_pair);
+}
+
+void ansi_renderer::put_part(int pos, cell_look look, int from, int to) {
+  // the characters of a cell between from and to, columns of the window
+  int x = (pos % play_x - view_x) * 2;
+  int first = std::max(x, from), last = std::min(x + 2, to);
+  if(first >= last) return;
+  move_to(pos / play_x - view_y, first);
+  use_pair(look.pair);
+  put(look.text + (first - x), last - first);
+  column += last - first;
+}
+
+void ansi_renderer::spaces(int y, int x, int count, int colour) {
+  // count spaces from x on. the screen may have been cleared in their
+  // colour already, erasing leaves the cursor where it is
+  if(!count || colour == cleared_pair) return;
+  move_to(y, x);
+  use_pair(colour);
+  if(erases_in_colour && count >= BLANK_RUN) {
+    put("\033[", 2);
+    put_number(count);
+    put("X", 1);
+    move_to(y, x + count);
+    return;
+  }
+  for(int i = 0; i < count; i++) frame[used++] = ' ';
+  column += count;
+}
@@ -0,0 +1,5 @@
+#ifndef WORM_RENDER_H
+#define WORM_RENDER_H
+class renderer;
+#include "render.cpp"
+#endif
@@ -0,0 +1,410 @@
+// recording a game and playing it back. a replay is how every round started
+// plus the turns the worms took, everything else follows from simulating
+// again. now and then a snapshot of the whole state goes in between, to check
+// that playback still matches and to seek without simulating from the start.
+//
+// the file, everything little endian (see message.cpp):
+//   "WORMREPL", version
+//   records of type, tick, length and length bytes:
+//     ROUND     state_hash() (high, low), width, height, level, players,
+//               food, match_random (high, low), then an int for every 32
+//               worms with a bit for each that isn't in the round
+//     SNAPSHOT  state_hash() (high, low), save_state()
+//     TURN      16 bits per worm that turned, number << 2 | heading, or
+//               LEAVING | number << 2 for a worm whose player left before
+//     CHECK     state_hash() (high, low), after the last tick of a round
+//     END       state_hash() (high, low)
+// the tick of a record counts all ticks simulated since recording started.
+// all but a turn have the state after that tick, a turn happens in it.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+
+#include "game.h"
+#include "network.h"
+
+const char REPLAY_MAGIC[8] = {'W', 'O', 'R', 'M', 'R', 'E', 'P', 'L'};
+const int REPLAY_VERSION = 2;
+const int REPLAY_ROUND = 1;
+const int REPLAY_SNAPSHOT = 2;
+const int REPLAY_TURN = 3;
+const int REPLAY_CHECK = 4;
+const int REPLAY_END = 5;
+// stepping is fast, so snapshots can be far apart. a seek simulates at most
+// this many ticks
+const long REPLAY_SNAPSHOT_INTERVAL = 10000;
+const size_t REPLAY_BUFFER = 64 << 10;
+const int LEAVING = 0x8000;
+
+// what replay_reader::step() did
+enum replay_steps {replay_tick, replay_round, replay_end};
+
+// headings as a turn record has them: up, right, down, left
+const int HEADING_X[4] = {0, 1, 0, -1};
+const int HEADING_Y[4] = {-1, 0, 1, 0};
+
+int heading_code(int x, int y) {
+  if(y < 0) return 0;
+  if(x > 0) return 1;
+  if(y > 0) return 2;
+  return 3;
+}
+
+// recording ------------------------------------------------------------------
+class replay_writer {
+  public:
+    replay_writer(const char* path);
+    ~replay_writer(void);        // writes the end and closes the file
+    void round(void);            // a new round is set up
+    void leave(int number);      // a worm dies because its player left
+    void tick(void);             // and one more tick of it simulated
+
+  private:
+    replay_writer(const replay_writer&);
+    replay_writer& operator=(const replay_writer&);
+    void snapshot(void);
+    void check(int type);
+    void record(int type, long tick, const uint8_t* data, size_t length);
+    void record_turns(long tick, int count);
+    void flush(void);
+
+    int fd;
+    bool failed;                 // a write went wrong, nothing more is written
+    long ticks;
+    message buffer;              // records not written yet
+    message state;
+    std::vector<direction> recorded; // the heading of every worm so far
+    uint16_t turns[MAX_PLAYER_NUMBER * 2];
+    uint8_t turn_bytes[MAX_PLAYER_NUMBER * 4];
+    int leaving;                 // turns[] that are worms left since the last tick
+};
+
+replay_writer::replay_writer(const char* path) {
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd == -1) error(path);
+  failed = false;
+  ticks = 0;
+  leaving = 0;
+  buffer.reserve(REPLAY_BUFFER);
+  buffer.insert(buffer.end(), REPLAY_MAGIC, REPLAY_MAGIC + 8);
+  append_ints(buffer, &REPLAY_VERSION, 1);
+}
+
+replay_writer::~replay_writer(void) {
+  // players that left after the last tick, their worms are dead in the end
+  if(leaving) record_turns(ticks + 1, leaving);
+  check(REPLAY_END);
+  flush();
+  close(fd);
+  if(failed) fprintf(stderr, "the replay could not be written completely\n");
+}
+
+void replay_writer::round(void) {
+  // new_round() makes the same round again from these
+  unsigned long long hash = state_hash();
+  uint64_t random_state = match_random.save();
+  int round[9] = {(int)(hash >> 32), (int)(unsigned)hash, play_x, play_y, level,
+                  (int)players.size(), food_count, (int)(random_state >> 32),
+                  (int)(uint32_t)random_state};
+  state.clear();
+  append_ints(state, round, 9);
+  for(size_t i = 0; i < players.size(); i += 32) {
+    unsigned absent = 0;
+    for(size_t j = i; j < players.size() && j < i + 32; j++) {
+      if(!players[j]->is_alive) absent |= 1u << (j - i);
+    }
+    append_ints(state, (const int*)&absent, 1);
+  }
+  record(REPLAY_ROUND, ticks, &state[0], state.size());
+  // a server may never get to close the file, keep what's worth keeping
+  flush();
+  leaving = 0;
+  recorded.resize(players.size());
+  for(size_t i = 0; i < players.size(); i++) {
+    recorded[i].x = players[i]->move_x;
+    recorded[i].y = players[i]->move_y;
+  }
+}
+
+void replay_writer::leave(int number) {
+  // between two ticks, so it goes with the turns of the next one
+  if(leaving < MAX_PLAYER_NUMBER) turns[leaving++] = (uint16_t)(LEAVING | number << 2);
+}
+
+void replay_writer::tick(void) {
+  // a worm heads somewhere else only if it took a turn this tick
+  ticks++;
+  int count = leaving;
+  leaving = 0;
+  for(size_t i = 0; i < players.size() && i < recorded.size(); i++) {
+    if(players[i]->move_x == recorded[i].x && players[i]->move_y == recorded[i].y) continue;
+    recorded[i].x = players[i]->move_x;
+    recorded[i].y = players[i]->move_y;
+    turns[count++] = (uint16_t)((i + 1) << 2 | heading_code(recorded[i].x, recorded[i].y));
+  }
+  if(count) record_turns(ticks, count);
+  // the next round starts over, whatever went wrong in this one shows now
+  if(gamestate == stopping) check(REPLAY_CHECK);
+  if(ticks % REPLAY_SNAPSHOT_INTERVAL == 0) snapshot();
+}
+
+void replay_writer::check(int type) {
+  unsigned long long hash = state_hash();
+  int check[2] = {(int)(hash >> 32), (int)(unsigned)hash};
+  uint8_t bytes[8];
+  put_ints(bytes, check, 2);
+  record(type, ticks, bytes, sizeof(bytes));
+}
+
+void replay_writer::snapshot(void) {
+  unsigned long long hash = state_hash();
+  int header[2] = {(int)(hash >> 32), (int)(unsigned)hash};
+  state.clear();
+  append_ints(state, header, 2);
+  save_state(state);
+  record(REPLAY_SNAPSHOT, ticks, &state[0], state.size());
+  flush();
+}
+
+void replay_writer::record(int type, long tick, const uint8_t* data, size_t length) {
+  int header[3] = {type, (int)tick, (int)length};
+  append_ints(buffer, header, 3);
+  buffer.insert(buffer.end(), data, data + length);
+  if(buffer.size() >= REPLAY_BUFFER) flush();
+}
+
+void replay_writer::record_turns(long tick, int count) {
+  put_shorts(turn_bytes, turns, count);
+  record(REPLAY_TURN, tick, turn_bytes, count * 2);
+}
+
+void replay_writer::flush(void) {
+  size_t written = 0;
+  while(!failed && written < buffer.size()) {
+    ssize_t n = write(fd, &buffer[written], buffer.size() - written);
+    if(n <= 0) failed = true;
+    else written += n;
+  }
+  buffer.clear();
+}
+
+replay_writer* recording = NULL; // --record, for all rounds of this run
+
+void record_round(void) {
+  // a client of a dedicated server doesn't simulate, nothing to record there
+  if(recording && is_authoritative()) recording->round();
+}
+
+void record_leave(int number) {
+  if(recording) recording->leave(number);
+}
+
+void record_tick(void) {
+  if(recording && is_authoritative()) recording->tick();
+}
+
+void finish_recording(void) {
+  // while the last state is still around for the end record
+  delete recording;
+  recording = NULL;
+}
+
+// playback -------------------------------------------------------------------
+class replay_reader {
+  public:
+    replay_reader(const char* path);
+    ~replay_reader(void);
+    replay_steps step(void);     // simulates the next tick
+    void seek(long tick);        // to the state after this tick
+    long tick(void) const {return now;}
+
+    long checks;                 // snapshots compared to the simulation
+    long mismatches;             // of those, the ones that didn't match
+    bool complete;               // the end has been reached and checked
+    bool broken;                 // a round or snapshot didn't load, playback stopped there
+
+  private:
+    struct record {
+      int type;
+      long tick;
+      size_t offset;             // of the data in the file
+      size_t length;
+    };
+    replay_reader(const replay_reader&);
+    replay_reader& operator=(const replay_reader&);
+    bool load(const record& r);
+    void give_up(void);
+    void check(const record& r);
+
+    const uint8_t* data;         // the whole file, mapped
+    size_t size;
+    std::vector<record> records;
+    std::vector<size_t> snapshots; // rounds and snapshots to seek from, by tick
+    size_t next;                 // the first record not handled yet
+    long now;
+    message state;
+};
+
+replay_reader::replay_reader(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if(fd == -1) error(path);
+  struct stat info;
+  if(fstat(fd, &info) == -1) error(path);
+  size = info.st_size;
+  data = NULL;
+  if(size) data = (const uint8_t*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(data == MAP_FAILED) error(path);
+  close(fd);
+  if(size < 12 || memcmp(data, REPLAY_MAGIC, 8)) {
+    fprintf(stderr, "%s: not a replay\n", path);
+    exit(1);
+  }
+  int version = get_int(data + 8);
+  if(version != REPLAY_VERSION) {
+    fprintf(stderr, "%s: replay version %d, this is version %d\n", path, version, REPLAY_VERSION);
+    exit(1);
+  }
+
+  // find the records once, a file cut short just ends early
+  size_t at = 12;
+  while(at + 12 <= size) {
+    int header[3];
+    get_ints(data + at, header, 3);
+    if(header[2] < 0 || at + 12 + header[2] > size) break;
+    record r = {header[0], header[1], at + 12, (size_t)header[2]};
+    // all but turns start with a hash
+    if(r.type != REPLAY_TURN && r.length < 8) break;
+    if(r.type == REPLAY_ROUND && r.length < 40) break;
+    if(r.type == REPLAY_ROUND || r.type == REPLAY_SNAPSHOT) snapshots.push_back(records.size());
+    records.push_back(r);
+    at += 12 + header[2];
+  }
+  if(records.empty() || records[0].type != REPLAY_ROUND) {
+    fprintf(stderr, "%s: no round in this replay\n", path);
+    exit(1);
+  }
+  checks = 0;
+  mismatches = 0;
+  complete = false;
+  broken = false;
+  next = 0;
+  now = 0;
+}
+
+replay_reader::~replay_reader(void) {
+  if(data) munmap((void*)data, size);
+}
+
+replay_steps replay_reader::step(void) {
+  // take care of everything up to the next tick, then run it
+  replay_steps result = replay_tick;
+  while(next < records.size()) {
+    const record& r = records[next];
+    if(r.type == REPLAY_ROUND && r.tick == now) {
+      if(!load(r)) {
+        give_up();
+        return replay_end;
+      }
+      check(r);
+      result = replay_round;
+    }
+    else if((r.type == REPLAY_SNAPSHOT || r.type == REPLAY_CHECK) && r.tick == now) check(r);
+    else if(r.type == REPLAY_TURN && r.tick == now + 1) {
+      for(size_t i = 0; i + 2 <= r.length; i += 2) {
+        uint16_t turn;
+        get_shorts(data + r.offset + i, &turn, 1);
+        int number = (turn & ~LEAVING) >> 2;
+        direction heading = {HEADING_X[turn & 3], HEADING_Y[turn & 3]};
+        if(number < 1 || number > (int)players.size()) continue;
+        if(turn & LEAVING) players[number-1]->is_alive = false;
+        else commands[number-1].push(heading);
+      }
+    }
+    else if(r.type == REPLAY_END && r.tick == now) {
+      check(r);
+      complete = true;
+      next = records.size();
+    }
+    else if(r.tick <= now) {} // nothing we know, or from the past
+    else break;
+    next++;
+  }
+  if(next >= records.size()) return replay_end;
+  simulate();
+  now++;
+  return result;
+}
+
+void replay_reader::seek(long tick) {
+  // from the last snapshot before, the rest is simulated
+  size_t from = 0;
+  for(size_t i = 0; i < snapshots.size() && records[snapshots[i]].tick <= tick; i++) {
+    from = snapshots[i];
+  }
+  if(!load(records[from])) {
+    give_up();
+    return;
+  }
+  now = records[from].tick;
+  next = from + 1;
+  complete = false;
+  while(now < tick && step() != replay_end) {}
+}
+
+bool replay_reader::load(const record& r) {
+  // a round or a snapshot, the state after its tick
+  state.assign(data + r.offset + 8, data + r.offset + r.length);
+  size_t at = 0;
+  if(r.type == REPLAY_SNAPSHOT) return load_state(state, at);
+
+  int round[7];
+  if(!read_ints(state, at, round, 7)) return false;
+  if(round[0] < 8 || round[1] < 8 || round[0] > 100000 || round[1] > 100000) return false;
+  if(round[3] < 1 || round[3] > MAX_PLAYER_NUMBER || round[4] < 0) return false;
+  // a level of a --levels file needs that file again
+  if(round[2] < 0 || round[2] >= level_count()) return false;
+  play_x = round[0];
+  play_y = round[1];
+  level = round[2];
+  player_count = round[3];
+  food_count = round[4];
+  new_round();
+  match_random.restore((uint64_t)(uint32_t)round[5] << 32 | (uint32_t)round[6]);
+  for(size_t i = 0; i < players.size(); i += 32) {
+    unsigned absent;
+    if(!read_ints(state, at, (int*)&absent, 1)) return false;
+    for(size_t j = i; j < players.size() && j < i + 32; j++) {
+      if(absent & (1u << (j - i))) {
+        players[j]->vanish();
+        players[j]->is_alive = false;
+      }
+    }
+  }
+  gamestate = running;
+  return true;
+}
+
+void replay_reader::give_up(void) {
+  // what a broken record left of the round is no use, nothing plays on
+  clear_players();
+  food.clear();
+  mismatches++;
+  broken = true;
+  next = records.size();
+}
+
+void replay_reader::check(const record& r) {
+  int hash[2];
+  get_ints(data + r.offset, hash, 2);
+  unsigned long long expected = (unsigned long long)(unsigned)hash[0] << 32 | (unsigned)hash[1];
+  checks++;
+  if(state_hash() != expected) mismatches++;
+}
+
+replay_reader* playback = NULL;  // --replay, the recording being shown
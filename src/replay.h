@@ -0,0 +1,6 @@
+#ifndef WORM_REPLAY_H
+#define WORM_REPLAY_H
+class replay_writer;
+class replay_reader;
+#include "replay.cpp"
+#endif
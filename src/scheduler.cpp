@@ -0,0 +1,103 @@
+// keeps the game loop on a fixed tick rate. every tick has an absolute
+// deadline on the steady clock, so time spent working, drawing or waiting
+// for the network doesn't add up to drift.
+
+#include <thread>
+#include <chrono>
+
+// what to do when a tick ends after the deadline of the next one
+enum overrun_policies {
+  catch_up, // run the missed ticks back to back until we're on time again
+  skip      // forget about the missed ticks and carry on from now
+};
+
+class scheduler {
+  public:
+    scheduler(int tick_ms);
+    void set_tick_ms(int tick_ms);
+    int tick_ms(void) const {return period_ms;}
+    void restart(void);
+    void wait(void);
+    int ms_to_deadline(void) const;
+
+    overrun_policies policy;
+    long ticks;          // ticks waited for since restart()
+    long late_ticks;     // ticks that started after their deadline
+    long skipped_ticks;  // deadlines dropped by the skip policy
+    double max_jitter_ms; // worst oversleep past a deadline
+    double mean_jitter_ms;
+
+  private:
+    int period_ms;
+    std::chrono::steady_clock::duration period;
+    std::chrono::steady_clock::time_point deadline;
+    double jitter_sum_ms;
+    long jitter_samples;
+};
+
+// never fall further behind than this many ticks, even when catching up
+const int MAX_CATCH_UP_TICKS = 5;
+const int MIN_TICK_MS = 10;
+const int MAX_TICK_MS = 2000;
+
+scheduler::scheduler(int tick_ms) {
+  policy = catch_up;
+  set_tick_ms(tick_ms);
+  restart();
+}
+
+void scheduler::set_tick_ms(int tick_ms) {
+  // may be called between two ticks, the next deadline keeps its old length
+  if(tick_ms < MIN_TICK_MS) tick_ms = MIN_TICK_MS;
+  if(tick_ms > MAX_TICK_MS) tick_ms = MAX_TICK_MS;
+  period_ms = tick_ms;
+  period = std::chrono::milliseconds(tick_ms);
+}
+
+void scheduler::restart(void) {
+  // start counting from now, e.g. after a blocking handshake
+  deadline = std::chrono::steady_clock::now();
+  ticks = 0;
+  late_ticks = 0;
+  skipped_ticks = 0;
+  max_jitter_ms = 0;
+  mean_jitter_ms = 0;
+  jitter_sum_ms = 0;
+  jitter_samples = 0;
+}
+
+void scheduler::wait(void) {
+  using namespace std::chrono;
+  ticks++;
+  deadline += period;
+  steady_clock::time_point now = steady_clock::now();
+
+  if(now >= deadline) {
+    // overrun: this tick is late already
+    late_ticks++;
+    long behind = (long)((now - deadline) / period);
+    if(policy == skip || behind >= MAX_CATCH_UP_TICKS) {
+      // move the deadline to the last one that passed, the next tick
+      // then runs right away and everything after it is on time
+      skipped_ticks += behind;
+      deadline += period * behind;
+    }
+    return;
+  }
+
+  std::this_thread::sleep_until(deadline);
+  double jitter_ms = duration<double, std::milli>(steady_clock::now() - deadline).count();
+  if(jitter_ms > max_jitter_ms) max_jitter_ms = jitter_ms;
+  jitter_sum_ms += jitter_ms;
+  jitter_samples++;
+  mean_jitter_ms = jitter_sum_ms / jitter_samples;
+}
+
+int scheduler::ms_to_deadline(void) const {
+  // for loops that wait somewhere else, e.g. in epoll_wait(). rounded down,
+  // wait() sleeps the last fraction of a millisecond
+  using namespace std::chrono;
+  steady_clock::duration left = deadline + period - steady_clock::now();
+  if(left <= steady_clock::duration::zero()) return 0;
+  return (int)duration_cast<milliseconds>(left).count();
+}
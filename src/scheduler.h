@@ -0,0 +1,5 @@
+#ifndef WORM_SCHEDULER_H
+#define WORM_SCHEDULER_H
+class scheduler;
+#include "scheduler.cpp"
+#endif
@@ -0,0 +1,453 @@
+// read-only viewers of a game, on a port of their own ("--spectators PORT").
+// the game thread encodes a tick once into a shared_frame, and the queue of
+// every viewer holds that same frame until it's written, nothing is copied
+// per viewer. a thread of our own accepts and writes, so a tick costs the
+// same with one viewer as with hundreds, and nothing while nobody watches.
+//
+// a viewer that falls VIEWER_FRAMES or VIEWER_BACKLOG behind loses what it
+// hasn't got yet and waits for a keyframe, like one that just joined. the
+// game only makes a keyframe when somebody waits for one and has written
+// everything else, a viewer that doesn't read at all costs nothing. that
+// keyframe comes after the delta of the same tick and only goes to the
+// viewers waiting, the others stay with the deltas.
+//
+// the protocol, in messages as network.cpp frames them:
+//   both ways on connect:      the hello of network::hello()
+//   to the viewer then:        0, width, height
+//   to the viewer every tick:  round, level, number of players, width,
+//                              height, a frame of the playground, then per
+//                              player move_x, move_y, score and alive
+//   from the viewer:           heartbeats
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <netdb.h>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#include "game.h"
+#include "network.h"
+#include "netthread.h"
+#include "spsc.h"
+
+const size_t VIEWER_FRAMES = 64;         // frames queued for a viewer, at most
+const size_t VIEWER_BACKLOG = 1 << 20;   // and bytes, or two keyframes if that's more
+const size_t SHARED_FRAMES = 256;        // frames in use at once, at most
+const int SPECTATOR_EVENTS = 64;
+const int WRITE_FRAMES = 64;             // frames in one writev()
+
+// a tick, framed and ready to write
+struct shared_frame {
+  message bytes;
+  bool keyframe;
+  bool catch_up;        // a keyframe for the waiting only, after the tick's delta
+  unsigned long tick;   // frames published before, a gap means some got lost
+  int users;            // viewers that haven't written it, only our thread counts
+};
+
+class viewer {
+  public:
+    viewer(int fd);
+    ~viewer(void) {close(fd);}
+
+    int fd;
+    bool greeted;
+    bool waits_for_keyframe;
+    bool wants_writing;          // EPOLLOUT is switched on
+    std::deque<shared_frame*> queue;
+    size_t sent;                 // bytes of queue.front() written already
+    size_t backlog;              // bytes in the queue not written yet
+    long long last_write;
+    message inbox;
+};
+
+viewer::viewer(int fd) {
+  this->fd = fd;
+  greeted = false;
+  waits_for_keyframe = true;
+  wants_writing = false;
+  sent = 0;
+  backlog = 0;
+  last_write = steady_ms();
+}
+
+class spectators {
+  public:
+    spectators(const char* port);
+    ~spectators(void);
+    // for the game thread, after a tick. redrawn says the change journal of
+    // the playground doesn't cover everything since the last tick
+    void publish(int round, bool redrawn);
+    int watching(void) const {return viewer_count;}
+
+  private:
+    spectators(const spectators&);
+    spectators& operator=(const spectators&);
+    shared_frame* free_frame(void);
+    void encode(shared_frame* frame, int round, bool keyframe);
+    void run(void);
+    void take_frames(void);
+    void accept_viewers(void);
+    bool read_from(viewer* v);
+    bool write_to(viewer* v);
+    void watch(viewer* v);
+    void drop(viewer* v);
+    void skip_ahead(viewer* v);
+    void release(shared_frame* frame);
+
+    int listen_fd, epoll_fd, wake_fd;
+    std::atomic<int> viewer_count;
+    std::atomic<bool> keyframe_wanted, running;
+    spsc_queue<shared_frame*> published, spares;
+
+    // the game thread's
+    std::vector<shared_frame*> frames;   // all there are, to delete them
+    std::vector<shared_frame*> unsent;   // didn't fit into published
+    unsigned long ticks;
+    int last_round;
+    bool missed;
+
+    // ours
+    std::vector<viewer*> viewers;
+    unsigned long last_tick;
+    int width, height;                   // of the last frame, for the welcome
+    shared_frame heartbeat;
+    std::thread worker;
+};
+
+spectators::spectators(const char* port) : viewer_count(0), keyframe_wanted(false), running(true),
+                                           published(SHARED_FRAMES), spares(SHARED_FRAMES) {
+  struct addrinfo hints, *result, *r;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  if(getaddrinfo(NULL, port, &hints, &result) != 0) error("getaddrinfo");
+  for(r = result; r != NULL; r = r->ai_next) {
+    listen_fd = socket(r->ai_family, r->ai_socktype, r->ai_protocol);
+    if(listen_fd == -1) continue;
+    int yes = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if(bind(listen_fd, r->ai_addr, r->ai_addrlen) == 0) break;
+    close(listen_fd);
+  }
+  if(!r) error("socket/bind");
+  freeaddrinfo(result);
+  if(listen(listen_fd, SOMAXCONN) == -1) error("listen");
+  set_nonblocking(listen_fd);
+
+  wake_fd = eventfd(0, EFD_NONBLOCK);
+  epoll_fd = epoll_create1(0);
+  if(wake_fd == -1 || epoll_fd == -1) error("epoll_create1");
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = NULL; // the listening socket
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event);
+  event.data.ptr = &wake_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event);
+
+  ticks = 0;
+  last_round = -1;
+  missed = false;
+  last_tick = 0;
+  width = play_x;
+  height = play_y;
+  int nothing = 0;
+  append_ints(heartbeat.bytes, &nothing, 1);
+  heartbeat.keyframe = false;
+  heartbeat.catch_up = false;
+  heartbeat.users = 0;
+  worker = std::thread(&spectators::run, this);
+}
+
+spectators::~spectators(void) {
+  running = false;
+  uint64_t one = 1;
+  if(write(wake_fd, &one, sizeof(one))) {}
+  worker.join();
+  for(size_t i = 0; i < viewers.size(); i++) delete viewers[i];
+  for(size_t i = 0; i < frames.size(); i++) delete frames[i];
+  close(epoll_fd);
+  close(wake_fd);
+  close(listen_fd);
+}
+
+void spectators::publish(int round, bool redrawn) {
+  // a frame like a dedicated server's, see the top. if there's no room for
+  // it the next one is a keyframe for everybody
+  if(!viewer_count) return;
+  PROFILE(phase_network);
+  shared_frame* frame = free_frame();
+  if(!frame) {
+    missed = true;
+    return;
+  }
+  bool everybody = redrawn || missed || round != last_round || keyframe_is_cheaper(playground);
+  bool asked = keyframe_wanted.exchange(false) && !everybody;
+  last_round = round;
+  frame->tick = ++ticks;
+  encode(frame, round, everybody);
+  missed = !published.push(frame);
+  if(missed) unsent.push_back(frame);
+  else if(asked) {
+    shared_frame* keyframe = free_frame();
+    bool sent = false;
+    if(keyframe) {
+      keyframe->tick = ticks;
+      encode(keyframe, round, true);
+      keyframe->catch_up = true;
+      sent = published.push(keyframe);
+      if(!sent) unsent.push_back(keyframe);
+    }
+    // or with the next tick
+    if(!sent) keyframe_wanted = true;
+  }
+  uint64_t one = 1;
+  if(write(wake_fd, &one, sizeof(one))) {}
+}
+
+shared_frame* spectators::free_frame(void) {
+  // NULL if all SHARED_FRAMES are in use
+  shared_frame* frame = NULL;
+  if(!unsent.empty()) {
+    frame = unsent.back();
+    unsent.pop_back();
+  }
+  else if(!spares.pop(frame) && frames.size() < SHARED_FRAMES) {
+    frame = new shared_frame;
+    frames.push_back(frame);
+  }
+  return frame;
+}
+
+void spectators::encode(shared_frame* frame, int round, bool keyframe) {
+  int header[6] = {0, round, level, (int)players.size(), play_x, play_y};
+  frame->keyframe = keyframe;
+  frame->catch_up = false;
+  frame->bytes.clear();
+  append_ints(frame->bytes, header, 6);
+  encode_playground(playground, keyframe, frame->bytes);
+  for(size_t i = 0; i < players.size(); i++) {
+    int state[4] = {players[i]->move_x, players[i]->move_y,
+                    players[i]->score, players[i]->is_alive};
+    append_ints(frame->bytes, state, 4);
+  }
+  int length = frame->bytes.size() - 4;
+  put_ints(&frame->bytes[0], &length, 1);
+}
+
+void spectators::run(void) {
+  // waking us mustn't cost the game its core, we write when it sleeps
+  struct sched_param lowest;
+  memset(&lowest, 0, sizeof(lowest));
+  pthread_setschedparam(pthread_self(), SCHED_IDLE, &lowest);
+  struct epoll_event events[SPECTATOR_EVENTS];
+  while(running) {
+    int count = epoll_wait(epoll_fd, events, SPECTATOR_EVENTS, HEARTBEAT_MS / 2);
+    for(int i = 0; i < count; i++) {
+      void* source = events[i].data.ptr;
+      if(!source) accept_viewers();
+      else if(source == &wake_fd) {
+        uint64_t woken;
+        if(read(wake_fd, &woken, sizeof(woken))) {}
+      }
+      else {
+        viewer* v = (viewer*)source;
+        if((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !read_from(v)) continue;
+        if(events[i].events & EPOLLOUT) write_to(v);
+      }
+    }
+    take_frames();
+    // a viewer that got nothing for a while still has to know we're here
+    long long now = steady_ms();
+    for(size_t i = 0; i < viewers.size(); i++) {
+      viewer* v = viewers[i];
+      if(!v->queue.empty() || now - v->last_write < HEARTBEAT_MS) continue;
+      v->queue.push_back(&heartbeat);
+      v->backlog += heartbeat.bytes.size();
+      if(!write_to(v)) i--;
+    }
+  }
+}
+
+void spectators::take_frames(void) {
+  // hand every frame the game published to all viewers that can take it
+  shared_frame* frame;
+  while(published.pop(frame)) {
+    frame->users = 0;
+    bool gap = !frame->catch_up && frame->tick != last_tick + 1;
+    last_tick = frame->tick;
+    get_ints(&frame->bytes[16], &width, 1);
+    get_ints(&frame->bytes[20], &height, 1);
+    size_t most_backlog = std::max(VIEWER_BACKLOG, 2 * (size_t)width * height * CELL_BYTES);
+    for(size_t i = 0; i < viewers.size(); i++) {
+      viewer* v = viewers[i];
+      if(gap || v->queue.size() >= VIEWER_FRAMES || v->backlog >= most_backlog) skip_ahead(v);
+      if(v->waits_for_keyframe ? !frame->keyframe : frame->catch_up) continue;
+      v->waits_for_keyframe = false;
+      v->queue.push_back(frame);
+      v->backlog += frame->bytes.size();
+      frame->users++;
+    }
+    // hold on to it until it went out everywhere it could
+    frame->users++;
+    for(size_t i = 0; i < viewers.size(); i++) {
+      viewer* v = viewers[i];
+      if(!v->queue.empty() && v->queue.back() == frame && !write_to(v)) i--;
+    }
+    release(frame);
+  }
+}
+
+void spectators::skip_ahead(viewer* v) {
+  // all it hasn't started writing goes, the stream must stay whole
+  size_t keep = (v->sent > 0) ? 1 : 0;
+  while(v->queue.size() > keep) {
+    v->backlog -= v->queue.back()->bytes.size();
+    release(v->queue.back());
+    v->queue.pop_back();
+  }
+  v->waits_for_keyframe = true;
+  if(v->queue.empty()) keyframe_wanted = true;
+}
+
+void spectators::release(shared_frame* frame) {
+  if(frame != &heartbeat && --frame->users == 0) spares.push(frame);
+}
+
+void spectators::accept_viewers(void) {
+  while(true) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if(fd == -1) return; // EAGAIN, all pending connections taken
+    set_nonblocking(fd);
+    set_nodelay(fd);
+    // hello and welcome, 28 bytes to a fresh socket don't block
+    int greeting[7] = {8, PROTOCOL_MAGIC, PROTOCOL_VERSION, 12, 0, width, height};
+    uint8_t bytes[28];
+    put_ints(bytes, greeting, 7);
+    if(write(fd, bytes, sizeof(bytes)) != (ssize_t)sizeof(bytes)) {
+      close(fd);
+      continue;
+    }
+    viewer* v = new viewer(fd);
+    viewers.push_back(v);
+    viewer_count = viewers.size();
+    keyframe_wanted = true;
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = v;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+  }
+}
+
+bool spectators::read_from(viewer* v) {
+  // false if the viewer is gone and v deleted. a viewer only says hello and
+  // that it's still there
+  uint8_t buffer[4096];
+  while(true) {
+    ssize_t got = read(v->fd, buffer, sizeof(buffer));
+    if(got > 0) {
+      v->inbox.insert(v->inbox.end(), buffer, buffer + got);
+      continue;
+    }
+    if(got == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    drop(v); // EOF or error
+    return false;
+  }
+  size_t used = 0;
+  while(v->inbox.size() - used >= 4) {
+    int length = get_int(&v->inbox[used]);
+    if(length != 0 && (length != 8 || v->greeted)) {
+      drop(v);
+      return false;
+    }
+    if(v->inbox.size() - used - 4 < (size_t)length) break;
+    if(length) {
+      int hello[2];
+      get_ints(&v->inbox[used + 4], hello, 2);
+      if(hello[0] != PROTOCOL_MAGIC || hello[1] != PROTOCOL_VERSION) {
+        drop(v);
+        return false;
+      }
+      v->greeted = true;
+    }
+    used += 4 + length;
+  }
+  v->inbox.erase(v->inbox.begin(), v->inbox.begin() + used);
+  return true;
+}
+
+bool spectators::write_to(viewer* v) {
+  // as many frames as the socket takes with one call. false if the viewer
+  // is gone and v deleted
+  while(!v->queue.empty()) {
+    struct iovec parts[WRITE_FRAMES];
+    int count = 0;
+    for(size_t i = 0; i < v->queue.size() && count < WRITE_FRAMES; i++, count++) {
+      const message& bytes = v->queue[i]->bytes;
+      size_t skip = i ? 0 : v->sent;
+      parts[count].iov_base = (void*)(bytes.data() + skip);
+      parts[count].iov_len = bytes.size() - skip;
+    }
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = parts;
+    header.msg_iovlen = count;
+    ssize_t written = sendmsg(v->fd, &header, MSG_NOSIGNAL);
+    if(written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+    if(written <= 0) {
+      drop(v);
+      return false;
+    }
+    v->last_write = steady_ms();
+    v->backlog -= written;
+    size_t left = written;
+    while(left > 0) {
+      size_t rest = v->queue.front()->bytes.size() - v->sent;
+      if(left < rest) {
+        v->sent += left;
+        break;
+      }
+      left -= rest;
+      release(v->queue.front());
+      v->queue.pop_front();
+      v->sent = 0;
+    }
+  }
+  // the keyframe after a skip, once it can take one
+  if(v->queue.empty() && v->waits_for_keyframe) keyframe_wanted = true;
+  watch(v);
+  return true;
+}
+
+void spectators::watch(viewer* v) {
+  // only ask for EPOLLOUT while there is something to write
+  bool wants_writing = !v->queue.empty();
+  if(wants_writing == v->wants_writing) return;
+  v->wants_writing = wants_writing;
+  struct epoll_event event;
+  event.events = EPOLLIN | (wants_writing ? (uint32_t)EPOLLOUT : 0u);
+  event.data.ptr = v;
+  epoll_ctl(epoll_fd, EPOLL_CTL_MOD, v->fd, &event);
+}
+
+void spectators::drop(viewer* v) {
+  for(size_t i = 0; i < v->queue.size(); i++) release(v->queue[i]);
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, v->fd, NULL);
+  viewers.erase(std::find(viewers.begin(), viewers.end(), v));
+  viewer_count = viewers.size();
+  delete v;
+}
+
+spectators* audience = NULL;   // --spectators, whoever watches our games
@@ -0,0 +1,7 @@
+#ifndef WORM_SPECTATE_H
+#define WORM_SPECTATE_H
+struct shared_frame;
+class viewer;
+class spectators;
+#include "spectate.cpp"
+#endif
@@ -0,0 +1,57 @@
+// a bounded queue for exactly one thread pushing and one thread popping,
+// without locks. items are swapped in and out rather than copied, so a queue
+// of vectors hands the same buffers back and forth and stops allocating once
+// they are big enough.
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+template <class T>
+class spsc_queue {
+  public:
+    spsc_queue(size_t capacity = 16);
+    bool push(T& item); // false if full, item is left alone then
+    bool pop(T& item);  // false if empty
+    bool empty(void) const {return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);}
+    bool full(void) const {return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire) > mask;}
+
+  private:
+    spsc_queue(const spsc_queue&);
+    spsc_queue& operator=(const spsc_queue&);
+
+    std::vector<T> slots;
+    size_t mask;                  // capacity - 1, capacity is a power of two
+    std::atomic<size_t> head;     // next to pop, only the consumer writes it
+    char padding[64];             // keeps head and tail off one cache line
+    std::atomic<size_t> tail;     // next to push, only the producer writes it
+};
+
+template <class T>
+spsc_queue<T>::spsc_queue(size_t capacity) : head(0), tail(0) {
+  size_t size = 1;
+  while(size < capacity) size *= 2;
+  slots.resize(size);
+  mask = size - 1;
+}
+
+template <class T>
+bool spsc_queue<T>::push(T& item) {
+  size_t t = tail.load(std::memory_order_relaxed);
+  if(t - head.load(std::memory_order_acquire) > mask) return false;
+  std::swap(slots[t & mask], item);
+  // publish the slot only after it is filled
+  tail.store(t + 1, std::memory_order_release);
+  return true;
+}
+
+template <class T>
+bool spsc_queue<T>::pop(T& item) {
+  size_t h = head.load(std::memory_order_relaxed);
+  if(h == tail.load(std::memory_order_acquire)) return false;
+  std::swap(item, slots[h & mask]);
+  // hand the slot back only after we're done with it
+  head.store(h + 1, std::memory_order_release);
+  return true;
+}
@@ -0,0 +1,5 @@
+#ifndef WORM_SPSC_H
+#define WORM_SPSC_H
+template <class T> class spsc_queue;
+#include "spsc.cpp"
+#endif
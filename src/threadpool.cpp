@@ -0,0 +1,88 @@
+// a fixed set of threads that run one job at a time, split into as many parts
+// as there are threads. the thread that hands out a job does the first part
+// itself and returns when all parts are done. a job is over in microseconds,
+// so the threads spin a little before they go to sleep on the next one.
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+
+const int POOL_SPINS = 2000; // looks at the job counter before sleeping
+
+class thread_pool {
+  public:
+    thread_pool(int threads);
+    ~thread_pool(void);
+    int size(void) const {return (int)workers.size() + 1;}
+    // job(part, size()) for every part, the calling thread is part 0
+    void run(void (*job)(int part, int parts));
+
+  private:
+    thread_pool(const thread_pool&);
+    thread_pool& operator=(const thread_pool&);
+    void work(int part);
+
+    std::vector<std::thread> workers;
+    std::mutex lock;
+    std::condition_variable wake, done;
+    void (*job)(int part, int parts);
+    std::atomic<unsigned long> jobs; // handed out so far
+    std::atomic<int> busy;           // workers not done with the last job
+    bool stopping;
+};
+
+thread_pool::thread_pool(int threads) : jobs(0), busy(0) {
+  job = NULL;
+  stopping = false;
+  for(int part = 1; part < threads; part++) {
+    workers.push_back(std::thread(&thread_pool::work, this, part));
+  }
+}
+
+thread_pool::~thread_pool(void) {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+    jobs++;
+  }
+  wake.notify_all();
+  for(size_t i = 0; i < workers.size(); i++) workers[i].join();
+}
+
+void thread_pool::run(void (*job)(int part, int parts)) {
+  if(workers.empty()) return job(0, 1);
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    this->job = job;
+    busy = (int)workers.size();
+    jobs++;
+  }
+  wake.notify_all();
+  job(0, size());
+  for(int spin = 0; spin < POOL_SPINS && busy; spin++) std::this_thread::yield();
+  std::unique_lock<std::mutex> guard(lock);
+  done.wait(guard, [this]{return !busy;});
+}
+
+void thread_pool::work(int part) {
+  unsigned long seen = 0;
+  while(true) {
+    for(int spin = 0; spin < POOL_SPINS && jobs == seen; spin++) std::this_thread::yield();
+    void (*next)(int part, int parts);
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      wake.wait(guard, [&]{return jobs != seen;});
+      seen = jobs;
+      if(stopping) return;
+      next = job;
+    }
+    next(part, size());
+    // the last one done wakes run(), under the lock so it can't miss it
+    if(busy.fetch_sub(1) == 1) {
+      std::lock_guard<std::mutex> guard(lock);
+      done.notify_one();
+    }
+  }
+}
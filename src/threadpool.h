@@ -0,0 +1,5 @@
+#ifndef WORM_THREADPOOL_H
+#define WORM_THREADPOOL_H
+class thread_pool;
+#include "threadpool.cpp"
+#endif
@@ -0,0 +1,312 @@
+// the connection of a network game over UDP, where one lost packet doesn't
+// hold up everything behind it until TCP sends it again. it carries the
+// same stream of bytes as the TCP socket would, cut into numbered segments:
+// whatever one send() got, which is what the network thread flushes in a
+// tick. every packet repeats the newest UDP_REDUNDANCY segments the peer
+// hasn't acknowledged, so losing one costs nothing as long as the next gets
+// through. older ones go out again after a retransmission timeout that
+// follows the round trip time.
+//
+// a packet is ints, little endian:
+//   UDP_MAGIC, kind, ack, stamp, echo
+//   and for UDP_DATA as many of   seq, length, that many bytes   as fit
+// ack is the first segment we haven't got yet, stamp our clock in us. echo
+// is the last stamp we got from the peer plus how long we held on to it, so
+// its clock minus echo is the round trip. 0 means nothing to echo yet.
+//
+// the client sends UDP_CONNECT until the host answers with UDP_ACCEPT or
+// anything else, the host answers every UDP_CONNECT. a client that hears
+// nothing goes for TCP instead, see client::client().
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <deque>
+#include <algorithm>
+#include <map>
+
+#include "message.h"
+
+const int UDP_MAGIC = 0x50445557;       // "WUDP"
+const int UDP_CONNECT = 1;
+const int UDP_ACCEPT = 2;
+const int UDP_DATA = 3;
+const int UDP_HEADER = 5;               // ints before the segments
+const size_t UDP_SEGMENT = 1024;        // a longer send() takes several
+const size_t UDP_PACKET = 1400;         // fits the MTU of about any network
+const size_t UDP_REDUNDANCY = 4;        // segments in every packet, at most
+const uint32_t UDP_WINDOW = 4096;       // unacknowledged segments before we give up
+const int UDP_MIN_RTO_US = 20000;
+const int UDP_MAX_RTO_US = 1000000;
+const int UDP_CONNECT_MS = 1000;        // how long a client waits for the host
+const int UDP_CONNECT_RETRY_MS = 100;
+const int UDP_POLL_MS = 100;            // waiting for a read, look after lost packets this often
+
+uint32_t steady_us(void) {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool seq_before(uint32_t a, uint32_t b) {
+  // for numbers that wrap around
+  return (int32_t)(a - b) < 0;
+}
+
+class udp_link {
+  public:
+    udp_link(int fd, bool hosting);
+    static bool is_connect(const uint8_t* packet, size_t length);
+    bool connect_to_host(void);   // false if the host doesn't answer
+    bool send(const uint8_t* bytes, size_t length);
+    // the next bytes of the stream, 0 if there are none yet and -1 if the
+    // peer is gone. never blocks
+    ssize_t receive(uint8_t* bytes, size_t length);
+    bool wait(int most_ms);       // until a packet came, sends again if due
+    int timer_ms(void) const;     // until something must go out again, -1 never
+    bool service(void);           // sends what's due again
+    size_t buffered(void) const {return stream.size() - stream_used;}
+    int rtt_us(void) const {return srtt;}
+
+    long resent;                  // packets sent again after a timeout
+
+  private:
+    bool send_packet(int kind, size_t first, size_t count);
+    bool send_newest(void);
+    bool read_packets(void);
+    void take(const uint8_t* packet, size_t length);
+    void sample_rtt(int rtt);
+    int rto_us(void) const;
+
+    int fd;
+    bool hosting, accepted, gone, must_ack;
+    uint32_t acked;               // the oldest segment the peer hasn't got
+    std::deque<message> unacked;  // from acked on
+    uint32_t oldest_sent;         // when unacked.front() last went out
+    int backoff;                  // timeouts in a row
+    uint32_t expected;            // the next segment for the stream
+    std::map<uint32_t, message> early;
+    message stream;               // in order, not read yet from stream_used on
+    size_t stream_used;
+    bool stamped;
+    uint32_t their_stamp, stamp_arrived, last_echo;
+    int srtt, rttvar;             // in us, srtt is 0 before the first sample
+    message packet;
+};
+
+udp_link::udp_link(int fd, bool hosting) {
+  this->fd = fd;
+  this->hosting = hosting;
+  accepted = hosting;
+  gone = false;
+  must_ack = false;
+  acked = 0;
+  oldest_sent = 0;
+  backoff = 0;
+  expected = 0;
+  stream_used = 0;
+  stamped = false;
+  their_stamp = stamp_arrived = last_echo = 0;
+  srtt = rttvar = 0;
+  resent = 0;
+  packet.reserve(UDP_PACKET);
+  if(hosting) send_packet(UDP_ACCEPT, 0, 0);
+}
+
+bool udp_link::is_connect(const uint8_t* packet, size_t length) {
+  int header[2];
+  if(length < UDP_HEADER * 4) return false;
+  get_ints(packet, header, 2);
+  return header[0] == UDP_MAGIC && header[1] == UDP_CONNECT;
+}
+
+bool udp_link::connect_to_host(void) {
+  for(int waited = 0; waited < UDP_CONNECT_MS && !gone && !accepted; waited += UDP_CONNECT_RETRY_MS) {
+    send_packet(UDP_CONNECT, 0, 0);
+    struct pollfd ready = {fd, POLLIN, 0};
+    poll(&ready, 1, UDP_CONNECT_RETRY_MS);
+    read_packets();
+  }
+  return accepted && !gone;
+}
+
+int udp_link::rto_us(void) const {
+  int rto = srtt ? srtt + std::max(4 * rttvar, 1000) : 200000;
+  rto = std::max(UDP_MIN_RTO_US, std::min(UDP_MAX_RTO_US, rto));
+  return std::min(UDP_MAX_RTO_US, rto << std::min(backoff, 6));
+}
+
+bool udp_link::send(const uint8_t* bytes, size_t length) {
+  if(gone) return false;
+  if(unacked.empty()) oldest_sent = steady_us();
+  do {
+    size_t part = std::min(length, UDP_SEGMENT);
+    unacked.push_back(message(bytes, bytes + part));
+    bytes += part;
+    length -= part;
+  } while(length > 0);
+  if(unacked.size() > UDP_WINDOW) gone = true;
+  return send_newest();
+}
+
+bool udp_link::send_newest(void) {
+  // the newest segments that fit, the ones before should have arrived already
+  size_t first = unacked.size(), room = UDP_PACKET - UDP_HEADER * 4;
+  while(first > 0 && unacked.size() - first < UDP_REDUNDANCY && 8 + unacked[first-1].size() <= room) {
+    first--;
+    room -= 8 + unacked[first].size();
+  }
+  return send_packet(UDP_DATA, first, unacked.size() - first);
+}
+
+bool udp_link::send_packet(int kind, size_t first, size_t count) {
+  // count segments of unacked from first on, after the header
+  uint32_t now = steady_us();
+  uint32_t echo = stamped ? their_stamp + (now - stamp_arrived) : 0;
+  int header[UDP_HEADER] = {UDP_MAGIC, kind, (int)expected, (int)(now | 1), (int)echo};
+  packet.clear();
+  append_ints(packet, header, UDP_HEADER);
+  for(size_t i = first; i < first + count; i++) {
+    int segment[2] = {(int)(acked + i), (int)unacked[i].size()};
+    append_ints(packet, segment, 2);
+    packet.insert(packet.end(), unacked[i].begin(), unacked[i].end());
+  }
+  if(count && first == 0) oldest_sent = now;
+  if(kind == UDP_DATA) must_ack = false;
+  // a lost packet is what UDP is about, only a refused one means the peer is gone
+  if(::send(fd, packet.data(), packet.size(), MSG_NOSIGNAL) == -1 && errno == ECONNREFUSED) gone = true;
+  return !gone;
+}
+
+ssize_t udp_link::receive(uint8_t* bytes, size_t length) {
+  // like TCP, what arrived before the peer went is still read
+  read_packets();
+  if(must_ack && !gone) send_packet(UDP_DATA, 0, 0);
+  size_t got = std::min(length, buffered());
+  if(!got && gone) return -1;
+  if(got) memcpy(bytes, &stream[stream_used], got);
+  stream_used += got;
+  if(stream_used == stream.size()) {
+    stream.clear();
+    stream_used = 0;
+  }
+  return got;
+}
+
+bool udp_link::read_packets(void) {
+  // everything that is there, without waiting
+  uint8_t buffer[65536];
+  while(!gone) {
+    ssize_t got = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if(got >= 0) take(buffer, got);
+    else if(errno == ECONNREFUSED) gone = true;
+    else if(errno != EINTR) break;
+  }
+  return !gone;
+}
+
+void udp_link::take(const uint8_t* bytes, size_t length) {
+  int header[UDP_HEADER];
+  if(length < sizeof(header)) return;
+  get_ints(bytes, header, UDP_HEADER);
+  if(header[0] != UDP_MAGIC) return;
+  if(header[1] == UDP_CONNECT) {
+    // our UDP_ACCEPT got lost
+    if(hosting) send_packet(UDP_ACCEPT, 0, 0);
+    return;
+  }
+  accepted = true;
+  uint32_t now = steady_us();
+
+  // what the peer has, and how long it took
+  uint32_t ack = header[2];
+  if(seq_before(acked, ack) && !seq_before(acked + unacked.size(), ack)) {
+    while(acked != ack) {
+      unacked.pop_front();
+      acked++;
+    }
+    oldest_sent = now;
+    backoff = 0;
+  }
+  if(!stamped || seq_before(their_stamp, header[3])) {
+    their_stamp = header[3];
+    stamp_arrived = now;
+    stamped = true;
+  }
+  uint32_t echo = header[4];
+  if(echo && echo != last_echo) {
+    sample_rtt((int32_t)(now - echo));
+    last_echo = echo;
+  }
+  if(header[1] != UDP_DATA) return;
+
+  // the segments go to the stream in order, the ones too early wait for it
+  size_t at = sizeof(header);
+  int segment[2];
+  while(at + 8 <= length) {
+    get_ints(bytes + at, segment, 2);
+    uint32_t seq = segment[0];
+    size_t size = segment[1];
+    at += 8;
+    if(segment[1] < 0 || size > UDP_SEGMENT || at + size > length) return;
+    must_ack = true;
+    if(seq == expected) {
+      stream.insert(stream.end(), bytes + at, bytes + at + size);
+      expected++;
+      std::map<uint32_t, message>::iterator next;
+      while((next = early.find(expected)) != early.end()) {
+        stream.insert(stream.end(), next->second.begin(), next->second.end());
+        early.erase(next);
+        expected++;
+      }
+    }
+    else if(seq_before(expected, seq) && seq - expected < UDP_WINDOW && !early.count(seq)) {
+      early[seq].assign(bytes + at, bytes + at + size);
+    }
+    at += size;
+  }
+}
+
+void udp_link::sample_rtt(int rtt) {
+  // as TCP does it, RFC 6298
+  if(rtt < 0 || rtt > 10000000) return;
+  if(!srtt) {
+    srtt = std::max(rtt, 1);
+    rttvar = rtt / 2;
+  }
+  else {
+    rttvar = (3 * rttvar + std::abs(srtt - rtt)) / 4;
+    srtt = std::max((7 * srtt + rtt) / 8, 1);
+  }
+}
+
+int udp_link::timer_ms(void) const {
+  if(unacked.empty() || gone) return -1;
+  int due = (int)(oldest_sent + rto_us() - steady_us());
+  return due <= 0 ? 0 : (due + 999) / 1000;
+}
+
+bool udp_link::service(void) {
+  // the oldest segments again when they took too long
+  if(!gone && !unacked.empty() && timer_ms() == 0) {
+    size_t count = 0, room = UDP_PACKET - UDP_HEADER * 4;
+    while(count < unacked.size() && count < UDP_REDUNDANCY && 8 + unacked[count].size() <= room) {
+      room -= 8 + unacked[count].size();
+      count++;
+    }
+    send_packet(UDP_DATA, 0, count);
+    resent++;
+    backoff++;
+  }
+  return !gone;
+}
+
+bool udp_link::wait(int most_ms) {
+  int due = timer_ms();
+  struct pollfd ready = {fd, POLLIN, 0};
+  poll(&ready, 1, (due >= 0 && due < most_ms) ? due : most_ms);
+  return service();
+}
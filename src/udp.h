@@ -0,0 +1,5 @@
+#ifndef WORM_UDP_H
+#define WORM_UDP_H
+class udp_link;
+#include "udp.cpp"
+#endif
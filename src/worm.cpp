@@ -26,571 +26,624 @@ SOFTWARE.
 
 #include <curses.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <algorithm>
 
+#include "game.h"
 #include "network.h"
+#include "scheduler.h"
+#include "dedicated.h"
+#include "netthread.h"
+#include "replay.h"
+#include "computer.h"
+#include "spectate.h"
+#include "render.h"
 
 using namespace std;
 
-// prototypes -----------------------------------------------------------------
-int xy(int x, int y);
-class player;
-class wormpiece;
-class food;
-
-// global constants -----------------------------------------------------------
-const int WALL = 1;
-const int WORMHEAD = 2;
-const int WORM = 3;
-const int FOOD = 4;
-const int INITIAL_MAX_WORMLENGTH = 3;
-
-// global enums
-enum gamemodes {not_set, single, local_multi, network_host, network_client};
-enum gamestates {starting, running, stopping, stopped};
-
 // global variables -----------------------------------------------------------
 int max_x, max_y;
-int play_x, play_y;
-int* playground = NULL;
-player* player1 = NULL;
-player* player2 = NULL;
-food* foodlist = NULL;
 bool no_quit_signal = true;
 bool paused;
 bool is_head;
 bool in_menu;
+bool full_redraw;
+atomic<int> gamespeed(200);  // milliseconds per tick, '+' and '-' change it
+overrun_policies overrun_policy = catch_up;
 //bool in_input;
 WINDOW* play_window = NULL;
 WINDOW* score_window = NULL;
 WINDOW* menu_window = NULL;
 WINDOW* input_window = NULL;
-gamemodes gamemode;
-gamestates gamestate;
+renderer* screen = NULL;       // draws play_window, see render.cpp
 network* nw_serv = NULL;
 network* nw_client = NULL;
+network_thread* nw_thread = NULL; // owns the socket of nw_serv or nw_client while a round runs
+message incoming, outgoing;
 char ip_hostname[20];
-char nw_port[5];
-
-// classes --------------------------------------------------------------------
-class wormpiece {
-  public:
-    wormpiece(int x, int y);
-    wormpiece(player* this_player);
-
-    int pos_x, pos_y;
-    wormpiece* connected_to;
-};
-
-class player {
-  public:
-    player(int num);
-    ~player(void);
-    void move(void);
-    bool collision(void);
-    bool eats_food(food* this_food);
-
-    int number;
-    int move_x;
-    int move_y;
-    int wormlength;
-    int input_x;
-    int input_y;
-    int max_wormlength;
-		wormpiece* head;
-    int score;
-    int highscore;
-    bool is_alive;
-};
-
-class food {
-  public:
-    food(int x, int y);
-    ~food();
-    void draw();
-    int length();
-    int countdown;
-    int pos_x, pos_y;
-    food* next;
-    food* prev;
-};
-
-// class functions ------------------------------------------------------------
-wormpiece::wormpiece(int x, int y) {
-  pos_x = x;
-  pos_y = y;
-  connected_to = NULL;
-}
-
-wormpiece::wormpiece(player* this_player) {
-  pos_x = this_player->head->pos_x + this_player->move_x;
-  pos_y = this_player->head->pos_y + this_player->move_y;
-  // check if we crossed the playground border
-  if(pos_x > play_x) pos_x = pos_x - play_x;
-  if(pos_x < 1) pos_x = play_x;
-  if(pos_y > play_y) pos_y = pos_y - play_y;
-  if(pos_y < 1) pos_y = play_y;
-  // attach to old worm
-  connected_to = this_player->head;
-}
+char nw_port[6];
+bool use_udp = false;   // --udp, joining asks the host for UDP first
+int my_number;          // the worm a dedicated server gave us
+int current_round = -1; // and the round of the dedicated server we're in
+// turns of our worm when a host or a server runs the round, see steer()
+spsc_queue<direction> to_send;
+const int CHECKSUM_INTERVAL = 50; // ticks between two desync checks
+const int PEER_TIMEOUT_MS = 5000; // give up on a peer that's silent for longer
+const int MAX_WATCHED_CELLS = 1 << 24; // a bigger board from a network peer is garbage
+bool fixed_size = false; // --size in a game, the board is that big whatever the terminal
+int followed_x, followed_y; // where the head the camera follows was last seen, from 0
+long round_ticks;
+bool desynced;
+atomic<long> seek_ticks(0); // how far to jump in a replay, see follow_replay()
+const long SEEK_STEP = 250;
+atomic<bool> show_profile(false); // 'i', phases instead of scores
 
-player::player(int num) {
-  this->number = num;
-  if(this->number == 1) {
-	  this->input_x = 1;
-	  this->input_y = 0;
-    this->head = new wormpiece(3, 3);
-  }
-  else if(this->number == 2) {
-	  this->input_x = -1;
-	  this->input_y = 0;
-    this->head = new wormpiece(play_x-2, play_y-3);
-  }
-  this->max_wormlength = INITIAL_MAX_WORMLENGTH;
-  this->score = 0;
-  this->is_alive = true;
+// functions ------------------------------------------------------------------
+void input_box(const char* msg, char* result, int size) {
+  delwin(input_window);
+  input_window = newwin(4, 24, max_y/2-2, max_x/2-10);
+  wbkgd(input_window, COLOR_PAIR(10));
+  wattrset(input_window, A_BOLD);
+  wcolor_set(input_window, 10, 0);
+  wclear(input_window);
+  wborder(input_window, 0, 0, 0, 0, 0, 0, 0, 0);
+  mvwaddstr(input_window, 1,2, msg);
+  wrefresh(input_window);
+  echo();
+  wcolor_set(input_window, 11, 0);
+  mvwaddstr(input_window, 2,2, "                    ");
+  do {
+    mvwgetnstr(input_window, 2,2, result, size-1);
+  } while(result[0]=='\0');
+  noecho();
 }
 
-void player::move() {
-  // get movement direction
-  this->move_x = this->input_x;
-  this->move_y = this->input_y;
-  // grow a new wormpiece in movement direction and make it the new head
-  this->head = new wormpiece(this);
-  // put the worm in the playground
-  wormpiece* piece = this->head;
-  wormlength = 0;
-
-  while(piece) {
-    if(piece == this->head) {
-      // prevent player2 head overwriting player1 for a sane collision check
-      if(playground[xy(piece->pos_x, piece->pos_y)] == 0) {
-        playground[xy(piece->pos_x, piece->pos_y)] = WORMHEAD + this->number*10;
-      }
-    }
-    else {
-      playground[xy(piece->pos_x, piece->pos_y)] = WORM + this->number*10;
-    }
-    this->wormlength++;
-    if(this->wormlength == this->max_wormlength) {
-      if(piece->connected_to) delete piece->connected_to;
-      piece->connected_to = 0;
+int followed_number(void) {
+  // our worm, or the first that's still alive if we only watch
+  if(gamemode==network_client) return 2;
+  if(gamemode==dedicated_client) return my_number;
+  if(gamemode==spectating || gamemode==replaying) {
+    for(size_t i = 0; i < players.size(); i++) {
+      if(players[i]->is_alive) return players[i]->number;
     }
-    piece = piece->connected_to;
   }
+  return 1;
 }
 
-bool player::collision(void) {
-  if( (playground[xy(this->head->pos_x, this->head->pos_y)] == WALL) ||
-      (playground[xy(this->head->pos_x, this->head->pos_y)] % 10 == WORM) ) {
-    this->is_alive = false;
-    return true;
+void move_camera(void) {
+  // a board bigger than the window is shown around the head of our worm.
+  // a client has no bodies, so the head is found among the cells that
+  // changed. the view only moves once the head comes close to its edge
+  int columns = getmaxx(play_window) / 2, rows = getmaxy(play_window);
+  if(columns >= play_x && rows >= play_y) {
+    if(screen->view_x || screen->view_y) full_redraw = true;
+    screen->view_x = screen->view_y = 0;
+    return;
   }
-  else {
-    return false;
+  cellvalue head = make_cell(WORMHEAD, followed_number());
+  for(int i = 0; i < playground.change_count; i++) {
+    int pos = playground.changes[i];
+    if(playground[pos] == head) {
+      followed_x = pos % play_x;
+      followed_y = pos / play_x;
+    }
   }
-}
-
-bool player::eats_food(food* this_food) {
-  if(this_food->pos_x == this->head->pos_x && this_food->pos_y == this->head->pos_y) {
-    this->max_wormlength += 5;
-    this->score += this->wormlength*5;
-    delete this_food;
-    return true;
+  int view_x = screen->view_x, view_y = screen->view_y;
+  int margin_x = columns / 5, margin_y = rows / 5;
+  if(followed_x < view_x + margin_x || followed_x >= view_x + columns - margin_x) view_x = followed_x - columns / 2;
+  if(followed_y < view_y + margin_y || followed_y >= view_y + rows - margin_y) view_y = followed_y - rows / 2;
+  view_x = std::max(0, std::min(view_x, play_x - columns));
+  view_y = std::max(0, std::min(view_y, play_y - rows));
+  if(view_x != screen->view_x || view_y != screen->view_y) {
+    screen->view_x = view_x;
+    screen->view_y = view_y;
+    full_redraw = true;
   }
-  else {return false;}
 }
 
-player::~player(void){
-  // delete all wormpiece objects
-  wormpiece* piece = this->head;
-  while(piece) {
-    wormpiece* nextpiece = piece->connected_to;
-    delete piece;
-    piece = nextpiece;
-  }
-  this->head = NULL;
+void draw_playground(bool everything) {
+  // what changed in the playground, or all of it if the screen has been
+  // messed with since the last frame
+  screen->on_top = in_menu ? menu_window : NULL;
+  screen->draw(play_window, everything);
 }
 
-
-food::food(int x, int y) {
-  countdown = 100; // ticks, not seconds
-  pos_x = x;
-  pos_y = y;
-  next = foodlist;
-  prev = NULL;
-  if(foodlist) foodlist->prev = this;
-  foodlist = this;
+void set_level_colours(void) {
+  // choose colors depending on level
+  if(!level_has_border(level)) background_pair = 8;
+  else background_pair = 9;
+  wbkgd(play_window, COLOR_PAIR(background_pair));
 }
 
-food::~food() {
-  if(this->prev) {this->prev->next = this->next;}
-  else {foodlist = this->next;}
-  if(this->next) {this->next->prev = this->prev;}
+void steer(int number, int x, int y) {
+  // a key only queues a turn, the tick takes it when the worm moves. we never
+  // touch a player here, the tick may be replacing them for a new round
+  direction turn = {x, y};
+  if(gamemode==replaying || gamemode==spectating) return;
+  if(gamemode==network_client || gamemode==dedicated_client) to_send.push(turn);
+  else commands[number-1].push(turn);
 }
 
-void food::draw() {
-  playground[xy(pos_x, pos_y)] = FOOD;
+void close_network(void) {
+  // the thread goes first, it still uses the socket
+  delete nw_thread; nw_thread = NULL;
+  delete nw_serv; nw_serv = NULL;
+  delete nw_client; nw_client = NULL;
 }
 
-int food::length() {
-  food* that = this;
-  int count = 0;
-  while(that) {
-    count++;
-    that = that->next;
+void send_turns(void) {
+  // everything our worm should do, for whoever runs the round
+  PROFILE(phase_network);
+  direction turn;
+  while(to_send.pop(turn)) {
+    int input[2] = {turn.x, turn.y};
+    outgoing.clear();
+    append_ints(outgoing, input, 2);
+    nw_thread->send(outgoing);
   }
-  return count;
 }
 
-// functions ------------------------------------------------------------------
-void input_box(char msg[20], char* result) {
-  delwin(input_window);
-  input_window = newwin(4, 24, max_y/2-2, max_x/2-10);
-  wbkgd(input_window, COLOR_PAIR(10));
-  wattrset(input_window, A_BOLD);
-  wcolor_set(input_window, 10, 0);
-  wclear(input_window);
-  wborder(input_window, 0, 0, 0, 0, 0, 0, 0, 0);
-  mvwaddstr(input_window, 1,2, msg);
-  wrefresh(input_window);
-  echo();
-  wcolor_set(input_window, 11, 0);
-  mvwaddstr(input_window, 2,2, "                    ");
-  //TODO use getchar and check each time if the user typed to many chars
-  do {
-    mvwgetstr(input_window, 2,2, result);
-  } while(result[0]=='\0');
-  noecho();
+void take_client_input(void) {
+  // the host runs the round. the turns of the client queue up like our own,
+  // if none came in time its worm just carries on as before
+  PROFILE(phase_network);
+  direction turn;
+  while(nw_thread->receive(incoming)) {
+    int input[2];
+    size_t at = 0;
+    if(!read_ints(incoming, at, input, 2)) continue;
+    turn.x = input[0];
+    turn.y = input[1];
+    commands[1].push(turn);
+  }
 }
 
-void quit(void) {
-  endwin();
+void send_tick(void) {
+  // tell the client where the worms went this tick, and now and then what
+  // state we ended up in so it can tell whether it still follows
+  PROFILE(phase_network);
+  round_ticks++;
+  int tick[6] = {(int)round_ticks, player1->move_x, player1->move_y,
+                 player2->move_x, player2->move_y, 0};
+  if(round_ticks % CHECKSUM_INTERVAL == 0) tick[5] = (int)state_hash();
+  outgoing.clear();
+  append_ints(outgoing, tick, 6);
+  nw_thread->send(outgoing);
 }
 
-int xy(int x, int y) {
-  // the idea here is that the playground array can be a one-dimensional array.
-  // xy(3,1) returns 2. (third element in the array)
-  // xy(3,4) would return 32 if the playground had 10 columns.
-  return play_x*(y-1) + x - 1;
+void follow_host(void) {
+  // lockstep: run every tick the host has sent since the last frame, with
+  // the inputs the host used. nothing arrived means nothing moves
+  int simulated = 0;
+  while(gamestate==running && nw_thread->receive(incoming)) {
+    int tick[6];
+    size_t at = 0;
+    if(!read_ints(incoming, at, tick, 6) || tick[0] != round_ticks + 1) {
+      desynced = true;
+      gamestate = stopping;
+      return;
+    }
+    player1->input_x = tick[1];
+    player1->input_y = tick[2];
+    player2->input_x = tick[3];
+    player2->input_y = tick[4];
+    // the change journal only covers the last tick
+    if(simulated++) full_redraw = true;
+    simulate();
+    record_tick();
+    round_ticks++;
+    if(round_ticks % CHECKSUM_INTERVAL == 0 && tick[5] != (int)state_hash()) {
+      desynced = true;
+      gamestate = stopping;
+    }
+  }
 }
 
-bool in_multiplayer(void) {
-  return (gamemode==local_multi || gamemode==network_host || gamemode==network_client);
+void make_round_windows(void) {
+  // a recorded or watched round may have another size and level than the
+  // one before
+  delwin(play_window);
+  play_window = newwin(std::min(play_y, max_y-10), std::min(play_x*2, max_x-10), 5, 5);
+  set_level_colours();
+  delwin(score_window);
+  score_window = newwin(3, std::min(play_x*2, max_x-10), 1, 5);
+  wbkgd(score_window, COLOR_PAIR(9));
+  wattrset(score_window, A_BOLD);
+  full_redraw = true;
 }
 
-void draw_level(int level) {
-  // draw borders
-  if(level==1 || level ==3) {
-    for(int x = 1; x <= play_x; x++) {
-      playground[xy(x,1)] = WALL;
+void follow_server(void) {
+  // take over every tick a dedicated server sent since the last frame, see
+  // dedicated.cpp for what is in there. what we watch has the size of the
+  // round in there as well, see spectate.cpp
+  PROFILE(phase_network);
+  bool broken = false;
+  while(!broken && nw_thread->receive(incoming)) {
+    int header[5];
+    size_t at = 0;
+    if(!read_ints(incoming, at, header, gamemode==spectating ? 5 : 3)) {
+      broken = true;
+      break;
     }
-    for(int x = 1; x <= play_x; x++) {
-      playground[xy(x,play_y)] = WALL;
-    }
-    for(int y = 1; y <= play_y; y++) {
-      playground[xy(1,y)] = WALL;
+    if(header[0] != current_round) {
+      // the server started a new round, a keyframe follows. nothing of it
+      // counts before all of it makes sense
+      if(header[2] < 1 || header[2] > MAX_PLAYER_NUMBER || my_number > header[2] ||
+         (gamemode==spectating && (header[3] < 1 || header[4] < 1 || (long)header[3] * header[4] > MAX_WATCHED_CELLS))) {
+        broken = true;
+        break;
+      }
+      current_round = header[0];
+      level = header[1];
+      player_count = header[2];
+      if(gamemode==spectating) {
+        play_x = header[3];
+        play_y = header[4];
+      }
+      new_round();
+      if(gamemode==spectating) {
+        // the scores of the first two, or of the only one
+        player1 = players[0];
+        player2 = (player_count == 2) ? players[1] : NULL;
+        make_round_windows();
+      }
+      else {
+        // we steer our worm like player 1 in singleplayer
+        player1 = players[my_number-1];
+        player2 = NULL;
+        set_level_colours();
+      }
+      full_redraw = true;
     }
-    for(int y = 1; y <= play_y; y++) {
-      playground[xy(play_x,y)] = WALL;
+    if(header[2] != (int)players.size() || !apply_playground(playground, incoming, at)) {
+      broken = true;
+      break;
     }
-  }
-  // draw central block
-  if(level==2 || level ==3) {
-    for(int j = play_y*3/7 +1; j <= play_y * 4/7; j++) {
-      for(int i = play_x*2/7 +1; i <= play_x * 5/7; i++) {
-        playground[xy(i,j)] = WALL;
+    for(size_t i = 0; i < players.size(); i++) {
+      int state[4];
+      if(!read_ints(incoming, at, state, 4)) {
+        broken = true;
+        break;
       }
+      players[i]->move_x = state[0];
+      players[i]->move_y = state[1];
+      players[i]->score = state[2];
+      players[i]->is_alive = state[3];
+      players[i]->input_x = state[0];
+      players[i]->input_y = state[1];
     }
   }
+  // a broken stream ends the round for good, see timing()
+  if(!broken) return;
+  desynced = true;
+  gamestate = stopping;
 }
 
-void clear_foodlist(void) {
-  // delete all food objects
-  food* foodpiece = foodlist;
-  while(foodpiece) {
-    food* nextpiece = foodpiece->next;
-    delete foodpiece;
-    foodpiece = nextpiece;
+void follow_replay(void) {
+  // the recording decides where the worms go, keys only move us through it
+  long jump = seek_ticks.exchange(0);
+  if(jump) {
+    playback->seek(std::max(0L, playback->tick() + jump));
+    make_round_windows();
   }
-  foodlist = NULL;
+  // a record that doesn't load leaves no round to show
+  if(playback->broken) {
+    gamestate = stopping;
+    return;
+  }
+  replay_steps result = playback->step();
+  if(result==replay_round) make_round_windows();
+  // the next round follows by itself, the end of the recording stops us
+  if(gamestate==stopping) gamestate = running;
+  if(result==replay_end) gamestate = stopping;
+}
+
+void format_ns(long long ns, char* out, size_t size) {
+  // at most five characters
+  const char* units[4] = {"ns", "us", "ms", "s"};
+  double value = ns;
+  int unit = 0;
+  while(value >= 999.5 && unit < 3) {
+    value /= 1000;
+    unit++;
+  }
+  snprintf(out, size, (unit && value < 9.95) ? "%.1f%s" : "%.0f%s", value, units[unit]);
+}
+
+void show_phases(void) {
+  // p50 and p99 of every phase since 'i' was pressed, where the scores were
+  werase(score_window);
+  for(int p = 0; p < PHASES; p++) {
+    char p50[16] = "-", p99[16] = "-";
+    if(profile.phase[p].count()) {
+      format_ns(profile.phase[p].percentile(50), p50, sizeof(p50));
+      format_ns(profile.phase[p].percentile(99), p99, sizeof(p99));
+    }
+    mvwprintw(score_window, p % 3, 1 + p / 3 * 21, "%-8s%5s %5s", PHASE_NAMES[p], p50, p99);
+  }
+}
+
+void quit(void) {
+  endwin();
+}
+
+bool in_multiplayer(void) {
+  return (gamemode==local_multi || gamemode==network_host || gamemode==network_client);
 }
 
 void timing(void) {
-  int gamespeed = 200;
-  int level;
-  chrono::milliseconds ms100(100);
+  scheduler ticker(gamespeed);
+  ticker.policy = overrun_policy;
   srand(time(0));
 
+  bool phases_shown = false;
   getmaxyx(stdscr, max_y, max_x);
   paused = true;
   in_menu = true;
   gamestate = stopped;
+  // a replay plays right away
+  if(gamemode==replaying) {
+    paused = false;
+    in_menu = false;
+    gamestate = starting;
+  }
 
   // game loop
   while(no_quit_signal) {
-    // measure time taken to substract it from gamedelay
-    clock_t timer_start, timer_end;
-    double cpu_time_used;
-    timer_start = clock();
-
-    // clear the main window
-    if(!paused) {
-      clear();
-      refresh();
-    }
     // is this the beginning of a new round?
     if(gamestate==starting) {
 
       getmaxyx(stdscr, max_y, max_x);
-
-      // clear all old food objects
-      clear_foodlist();
+      // the recording has the size, level and worms of the round
+      if(gamemode==replaying) playback->seek(0);
 
       // configure network if needed
-      if(nw_serv) delete nw_serv; nw_serv = NULL;
-      if(nw_client) delete nw_client; nw_client = NULL;
+      close_network();
       if(gamemode==network_host)
         nw_serv = new server(nw_port);
-      else if(gamemode==network_client)
-        nw_client = new client(nw_port, ip_hostname);
-
-      // negotiate the size of the playground between server and client
+      else if(gamemode==network_client || gamemode==dedicated_client || gamemode==spectating)
+        nw_client = new client(nw_port, ip_hostname, use_udp);
+
+      // a peer that speaks another protocol is as good as gone
+      if(nw_serv) nw_serv->hello();
+      if(nw_client) nw_client->hello();
+
+      // the size of the playground. a game of our own fills the terminal
+      // unless --size says otherwise, the camera shows what doesn't fit
+      if(gamemode!=dedicated_client && gamemode!=spectating && gamemode!=replaying && !fixed_size) {
+        play_x = (max_x-10)/2;
+        play_y = max_y-10;
+      }
+      // between host and client the host decides. without --size it's
+      // what fits on both terminals, the client plays whatever it gets
+      size_t at = 0;
       if(gamemode==network_client) {
-        nw_client->send_int(max_x);
-        nw_client->send_int(max_y);
-        nw_client->receive_int(max_x);
-        nw_client->receive_int(max_y);
+        int board[2] = {play_x, play_y};
+        outgoing.clear();
+        append_ints(outgoing, board, 2);
+        nw_client->send_message(outgoing);
+        if(nw_client->receive_message(incoming)) read_ints(incoming, at, board, 2);
+        if(board[0] < 1 || board[1] < 1 || (long)board[0] * board[1] > MAX_WATCHED_CELLS) nw_client->is_connected = false;
+        else {
+          play_x = board[0];
+          play_y = board[1];
+        }
       }
       else if(gamemode==network_host) {
-        int clients_max_x, clients_max_y;
-        nw_serv->receive_int(clients_max_x);
-        nw_serv->receive_int(clients_max_y);
-        if(clients_max_x > max_x) 
-          clients_max_x = max_x;
-        else
-          max_x = clients_max_x;
-        if(clients_max_y > max_y)
-          clients_max_y = max_y;
-        else
-          max_y = clients_max_y;
-        nw_serv->send_int(clients_max_x);
-        nw_serv->send_int(clients_max_y);
+        int board[2] = {play_x, play_y};
+        if(nw_serv->receive_message(incoming)) read_ints(incoming, at, board, 2);
+        if(!fixed_size) {
+          play_x = std::max(1, std::min(play_x, board[0]));
+          play_y = std::max(1, std::min(play_y, board[1]));
+        }
+        board[0] = play_x;
+        board[1] = play_y;
+        outgoing.clear();
+        append_ints(outgoing, board, 2);
+        nw_serv->send_message(outgoing);
+      }
+      else if(gamemode==dedicated_client || gamemode==spectating) {
+        // the server decides on the size and which worm is ours, if any. we
+        // show as much of the playground as fits on the screen
+        int welcome[3] = {0, play_x, play_y};
+        if(nw_client->receive_message(incoming)) read_ints(incoming, at, welcome, 3);
+        my_number = welcome[0];
+        play_x = welcome[1];
+        play_y = welcome[2];
+        if(!my_number && gamemode==dedicated_client) nw_client->is_connected = false; // server is full
+        current_round = -1;
       }
 
-      // (re)create game-window and -array
+      // (re)create game-window
       delwin(play_window);
-      if(playground) {delete[] playground; playground = NULL;}
-      play_x = (max_x-10)/2;
-      play_y = max_y-10;
-      play_window = newwin(play_y, play_x*2, 5, 5);
-      playground = new int [play_x * play_y];
-
-      // choose one of four different levels (not on client)
-      if(gamemode!=network_client) level = (rand() % 4);
-      // tell the client which level we play in
-      if(gamemode==network_host) nw_serv->send_int(level);
-      if(gamemode==network_client) nw_client->receive_int(level);
+      play_window = newwin(std::min(play_y, max_y-10), std::min(play_x*2, max_x-10), 5, 5);
+
+      // choose a level and the seed of the round. the client plays whatever
+      // the host chose, so both simulate the same. it only has the built-in
+      // levels for sure
+      int round_seed = rand();
+      if(gamemode==network_host) level = (rand() % BUILTIN_LEVELS);
+      else if(gamemode!=replaying) level = (rand() % level_count());
+      int round_setup[3] = {level, round_seed, food_count};
+      if(gamemode==network_host) {
+        outgoing.clear();
+        append_ints(outgoing, round_setup, 3);
+        nw_serv->send_message(outgoing);
+      }
+      at = 0;
+      if(gamemode==network_client && nw_client->receive_message(incoming)) {
+        read_ints(incoming, at, round_setup, 3);
+        level = round_setup[0];
+        round_seed = round_setup[1];
+        food_count = round_setup[2];
+      }
       // => here is were the game halts when the other side isn't ready yet
+      if(gamemode!=replaying) match_random.seed(round_seed);
 
-      // choose colors depending on level
-      if(level==0 || level ==2) wbkgd(play_window, COLOR_PAIR(8));
-      else wbkgd(play_window, COLOR_PAIR(9));
+      set_level_colours();
 
       // (re)create new window for score
       delwin(score_window);
-      score_window = newwin(3, play_x*2, 1, 5);
+      score_window = newwin(3, std::min(play_x*2, max_x-10), 1, 5);
       wbkgd(score_window, COLOR_PAIR(9));
       wattrset(score_window, A_BOLD);
 
-      // remove player object from last round
-      if(player1) delete player1; player1 = NULL;
-      if(player2) delete player2; player2 = NULL;
-
-      // create players' worms
-      player1 = new player(1);
-      if(gamemode!=single) player2 = new player(2);
+      // fresh playground, food and worms
+      if(gamemode!=replaying) {
+        player_count = (gamemode==single || gamemode==dedicated_client || gamemode==spectating) ? 1 : 2;
+        computer_players = (gamemode==versus_computer) ? 1 : 0;
+        new_round();
+      }
+      direction stale;
+      while(to_send.pop(stale)) {}
+      round_ticks = 0;
+      desynced = false;
+      // from here on the socket belongs to the network thread
+      if(nw_serv) nw_thread = new network_thread(nw_serv);
+      if(nw_client) nw_thread = new network_thread(nw_client);
 
       // now all is ready to have the round running
       gamestate=running;
+      if(gamemode!=replaying) record_round();
+      full_redraw = true;
+      // the handshake above may have blocked for a long time
+      ticker.restart();
     }
 
 
     // the in-game stuff like moving the players happens in this block
     if(!paused && gamestate==running) {
-      // clear the hole window
-      wclear(play_window);
-      // clear the playground
-      for(int p = 0; p < (play_x*play_y); p++) {
-          playground[p] = 0;
-      }
-
-      // send and receive movement infos via network
-      if(gamemode==network_host) {
-        nw_serv->send_input(player1->input_x, player1->input_y);
-        nw_serv->receive_input(player2->input_x, player2->input_y);
-      }
+      PROFILE(phase_tick);
+      if(gamemode==replaying) follow_replay();
+      else if(gamemode==spectating) follow_server();
       else if(gamemode==network_client) {
-        nw_client->receive_input(player1->input_x, player1->input_y);
-        nw_client->send_input(player2->input_x, player2->input_y);
+        // the host runs the round, we tell it where we want to go
+        send_turns();
+        follow_host();
       }
+      else {
+        if(gamemode==network_host) take_client_input();
+        if(gamemode==dedicated_client) send_turns();
+        else think();
 
-      // move the player(s)
-      if(player1->is_alive) player1->move();
-      if(player2 && player2->is_alive) player2->move();
-
-      // refresh food objects and check if a player is eating one (not on client side) FIXME: how does p2 grow on clientside???
-      if(gamemode!=network_client) {
-        food* foodpiece = foodlist;
-        while(foodpiece) {
-          food* nextpiece = foodpiece->next;
-          if (foodpiece->countdown > 0) {
-            // worm eating food?
-            if( ! (player1->eats_food(foodpiece) || (player2 && player2->eats_food(foodpiece)))) {
-              foodpiece->countdown--;
-              foodpiece->draw();
-            }
-          }
-          else { // countdown is over
-            delete foodpiece;
-          }
-          foodpiece = nextpiece;
-        }
-        draw_level(level);
-      }
+        // move the player(s) and let them eat
+        move_players();
+        update_food();
 
-      // sync playground to the client
-      if(gamemode==network_host) {
-        nw_serv->send_playground(playground, play_x, play_y);
-      }
-      else if(gamemode==network_client) {
-        nw_client->receive_playground(playground, play_x, play_y);
-      }
+        // randomly create new food for the next iteration
+        spawn_food();
 
-      // detect collisions
-      if(player2 && player2->is_alive) player2->collision();
-      if(player1->is_alive) player1->collision();
-      // if none lives anymore then remember to exit this round
-      if(! (player1->is_alive || (player2 && player2->is_alive))) gamestate = stopping;
-
-      // draw the playground in the window
-      for(int y = 1; y <= play_y; y++) {
-        for(int x = 1; x <= play_x; x++) {
-          switch(playground[xy(x, y)]) {
-            case WALL:
-              wcolor_set(play_window, WALL, 0);
-              if(level==2) wcolor_set(play_window, 9, 0);
-              mvwaddstr(play_window, y-1, (x-1)*2, "  ");
-              break;
-            case WORMHEAD+10:
-              wcolor_set(play_window, WORMHEAD+10, 0);
-              if(player1->move_x==1) mvwaddstr(play_window, y-1, (x-1)*2, ": ");
-              if(player1->move_x==-1) mvwaddstr(play_window, y-1, (x-1)*2, " :");
-              if(player1->move_y==1) mvwaddstr(play_window, y-1, (x-1)*2, "..");
-              if(player1->move_y==-1) mvwaddstr(play_window, y-1, (x-1)*2, "..");
-              break;
-            case WORMHEAD+20:
-              wcolor_set(play_window, WORMHEAD+20, 0);
-              if(player2->move_x==1) mvwaddstr(play_window, y-1, (x-1)*2, ": ");
-              if(player2->move_x==-1) mvwaddstr(play_window, y-1, (x-1)*2, " :");
-              if(player2->move_y==1) mvwaddstr(play_window, y-1, (x-1)*2, "..");
-              if(player2->move_y==-1) mvwaddstr(play_window, y-1, (x-1)*2, "..");
-              break;
-            case WORM+10:
-              wcolor_set(play_window, WORM+10, 0);
-              mvwaddstr(play_window, y-1, (x-1)*2, "  ");
-              break;
-            case WORM+20:
-              wcolor_set(play_window, WORM+20, 0);
-              mvwaddstr(play_window, y-1, (x-1)*2, "  ");
-              break;
-            case FOOD:
-              wcolor_set(play_window, FOOD, 0);
-              mvwaddstr(play_window, y-1, (x-1)*2, "  ");
-              break;
-          }
-        }
-      }
+        // take over the state of a dedicated server
+        if(gamemode==dedicated_client) follow_server();
 
-      // randomly create new food for the next iteration
-      if(gamemode != network_client) {
-        // never have more than 3 on the screen
-        if(!foodlist || foodlist->length() < 3) {
-          if(!(rand() % 10)) {
-            int rand_x = (rand() % play_x);
-            int rand_y = (rand() % play_y);
-            if(playground[xy(rand_x, rand_y)] % 10 != WORM && playground[xy(rand_x, rand_y)] != WALL) {
-              new food(rand_x, rand_y);
-            }
-          }
-        }
+        // detect collisions
+        detect_collisions();
+        record_tick();
+        // a dedicated server starts the next round by itself, a stream
+        // that made no sense ends it for good
+        if(gamemode==dedicated_client && gamestate==stopping && !desynced) gamestate = running;
+
+        if(gamemode==network_host) send_tick();
       }
 
-      // refresh the window. until now nothing was updated.
-      wrefresh(play_window);
+      // whoever watches us sees what we're about to draw
+      if(audience) audience->publish(rounds_started, full_redraw);
 
-      // sync score to the client
-      if(gamemode==network_host) {
-        nw_serv->send_int(player1->score);
-        nw_serv->send_int(player2->score);
+      // draw what changed in the playground, or all of it if the screen
+      // has been messed with since the last frame
+      {
+        PROFILE(phase_draw);
+        move_camera();
+        draw_playground(full_redraw);
+        full_redraw = false;
       }
-      else if(gamemode==network_client) {
-        nw_client->receive_int(player1->score);
-        nw_client->receive_int(player2->score);
+
+      // give up on the round when the other side is gone or silent
+      if(nw_thread && (!nw_thread->is_connected() || nw_thread->silent_ms() > PEER_TIMEOUT_MS)) {
+        gamestate = stopping;
       }
 
-      // refresh score window
-      wclear(score_window);
-      if(player1->score > player1->highscore) {player1->highscore = player1->score;}
-      mvwprintw(score_window, 0, 1, "PLAYER 1");
-      if(!player1->is_alive) mvwprintw(score_window, 0, 10, "DEAD!");
-      mvwprintw(score_window, 1, 1, "Score: %010d\n", player1->score);
-      mvwprintw(score_window, 2, 1, "Best : %010d\n", player1->highscore);
+      // refresh score window. wclear() would have the whole terminal
+      // cleared and painted again, playground and all
+      werase(score_window);
+      int score_width = getmaxx(score_window);
+      // a broken replay has no players left to show
+      if(player1) {
+        if(player1->score > player1->highscore) {player1->highscore = player1->score;}
+        mvwprintw(score_window, 0, 1, "PLAYER %d", gamemode==dedicated_client ? my_number : 1);
+        if(!player1->is_alive) mvwprintw(score_window, 0, 10, "DEAD!");
+        mvwprintw(score_window, 1, 1, "Score: %010d\n", player1->score);
+        mvwprintw(score_window, 2, 1, "Best : %010d\n", player1->highscore);
+      }
       if(player2) {
         if(player2->score > player2->highscore) {player2->highscore = player2->score;}
-        mvwprintw(score_window, 0, play_x*2 -17, "PLAYER 2");
-        if(!player2->is_alive) mvwprintw(score_window, 0, max_x -10, "DEAD!");
-        mvwprintw(score_window, 1, play_x*2 -17, "Score: %010d\n", player2->score);
-        mvwprintw(score_window, 2, play_x*2 -17, "Best : %010d\n", player2->highscore);
+        mvwprintw(score_window, 0, score_width -17, "PLAYER 2");
+        if(!player2->is_alive) mvwprintw(score_window, 0, score_width -8, "DEAD!");
+        mvwprintw(score_window, 1, score_width -17, "Score: %010d\n", player2->score);
+        mvwprintw(score_window, 2, score_width -17, "Best : %010d\n", player2->highscore);
       }
+      else if((gamemode==dedicated_client || gamemode==spectating) && score_width >= 52) {
+        int alive = 0;
+        for(size_t i = 0; i < players.size(); i++) alive += players[i]->is_alive;
+        mvwprintw(score_window, 0, score_width -17, "ROUND %d", current_round);
+        mvwprintw(score_window, 1, score_width -17, "%d of %d alive", alive, (int)players.size());
+      }
+      // how well we keep the pace, if there's room between the scores
+      if(score_width >= 62) {
+        mvwprintw(score_window, 0, score_width/2 -11, "tick %4dms", ticker.tick_ms());
+        mvwprintw(score_window, 1, score_width/2 -11, "late %6ld", ticker.late_ticks);
+        mvwprintw(score_window, 2, score_width/2 -11, "jitter %4.1fms", ticker.max_jitter_ms);
+      }
+      if(desynced) mvwprintw(score_window, 1, score_width/2 -11, "DESYNC! %6ld", round_ticks);
+      if(gamemode==replaying) mvwprintw(score_window, 1, score_width/2 -11, "replay %7ld", playback->tick());
+      // what it looks like from now on, not since the start
+      if(show_profile && !phases_shown) profile.clear();
+      phases_shown = show_profile;
+      if(phases_shown) show_phases();
       wrefresh(score_window);
     }
 
     // refresh menu
     if(in_menu) {
       delwin(menu_window);
-      menu_window = newwin(10, 28, max_y/2-5, max_x/2-14);
+      menu_window = newwin(12, 28, max_y/2-5, max_x/2-14);
       wbkgd(menu_window, COLOR_PAIR(10));
       wattrset(menu_window, A_BOLD);
-      wclear(menu_window);
+      werase(menu_window);
       wborder(menu_window, 0, 0, 0, 0, 0, 0, 0, 0);
       mvwprintw(menu_window, 1, 3, "CurseWorm       v.0.8");
       mvwprintw(menu_window, 3, 3, "[1] singleplayer");
       mvwprintw(menu_window, 4, 3, "[2] local multiplayer");
       mvwprintw(menu_window, 5, 3, "[3] host network game"); //"this is a menu : %010d\n", highscore);
       mvwprintw(menu_window, 6, 3, "[4] join network game");
-      mvwprintw(menu_window, 7, 3, "[q] quit");
+      mvwprintw(menu_window, 7, 3, "[5] join dedicated game");
+      mvwprintw(menu_window, 8, 3, "[6] play the computer");
+      mvwprintw(menu_window, 9, 3, "[7] watch a game");
+      mvwprintw(menu_window, 10, 3, "[q] quit");
       wrefresh(menu_window);
     }
 
     // exit to menu if there is no living player
     if(gamestate==stopping) {
-      clear_foodlist();
+      close_network();
+      food.clear();
       gamemode = not_set;
       in_menu = true;
       gamestate = stopped;
     }
     else {
-    // wait for a while
-      timer_end = clock();
-      cpu_time_used = ((double) (timer_end - timer_start)) / CLOCKS_PER_SEC * 1000;
-      chrono::milliseconds dura(gamespeed-(int)cpu_time_used);
-      this_thread::sleep_for(dura);
+      // wait for the next tick
+      if(ticker.tick_ms() != gamespeed) ticker.set_tick_ms(gamespeed);
+      ticker.wait();
     }
   }
-  clear_foodlist();
+  close_network();
+  food.clear();
   return;
 }
 
@@ -603,80 +656,76 @@ void controlling(void) {
     switch (getch()) {
       case KEY_UP:
         if(gamemode==local_multi || gamemode==network_client){
-          if(!(player2->move_y)) {
-            player2->input_x = 0;
-            player2->input_y = -1;
-          }
+          steer(2, 0, -1);
           break;
         }
         if(gamemode==network_host) break;
       case 'w':
       case 'W':
         if(gamemode!=network_client) {
-          if(!(player1->move_y)) {
-            player1->input_x = 0;
-            player1->input_y = -1;
-          }
+          steer(1, 0, -1);
         }
         break;
       case KEY_DOWN:
         if(gamemode==local_multi || gamemode==network_client){
-          if(!player2->move_y) {
-            player2->input_x = 0;
-            player2->input_y = +1;
-          }
+          steer(2, 0, +1);
           break;
         }
         if(gamemode==network_host) break;
       case 's':
       case 'S':
         if(gamemode!=network_client) {
-          if(!player1->move_y) {
-            player1->input_x = 0;
-            player1->input_y = +1;
-          }
+          steer(1, 0, +1);
         }
         break;
       case KEY_LEFT:
         if(gamemode==local_multi || gamemode==network_client) {
-          if(!player2->move_x) {
-            player2->input_x = -1;
-            player2->input_y = 0;
-          }
+          steer(2, -1, 0);
           break;
         }
         if(gamemode==network_host) break;
       case 'a':
       case 'A':
         if(gamemode!=network_client) {
-          if(!player1->move_x) {
-            player1->input_x = -1;
-            player1->input_y = 0;
-          }
+          steer(1, -1, 0);
         }
         break;
       case KEY_RIGHT:
         if(gamemode==local_multi || gamemode==network_client) {
-          if(!player2->move_x) {
-            player2->input_x = +1;
-            player2->input_y = 0;
-          }
+          steer(2, +1, 0);
           break;
         }
         if(gamemode==network_host) break;
       case 'd':
       case 'D':
         if(gamemode!=network_client) {
-          if(!player1->move_x) {
-            player1->input_x = +1;
-            player1->input_y = 0;
-          }
+          steer(1, +1, 0);
         }
         break;
+      case '+':
+        gamespeed = gamespeed * 9 / 10;
+        if(gamespeed < MIN_TICK_MS) gamespeed = MIN_TICK_MS;
+        break;
+      case '-':
+        gamespeed = gamespeed * 11 / 10 + 1;
+        if(gamespeed > MAX_TICK_MS) gamespeed = MAX_TICK_MS;
+        break;
       case 'p':
       case 'P':
         paused = !paused;
         break;
+      case 'i':
+      case 'I':
+        show_profile = !show_profile;
+        break;
+      case 'f':
+      case 'F':
+        if(gamemode==replaying) seek_ticks += SEEK_STEP;
+        break;
+      case 'b':
+      case 'B':
+        if(gamemode==replaying) seek_ticks -= SEEK_STEP;
+        break;
       case 'q':
       case 'Q':
         if(in_menu) no_quit_signal = false;
@@ -697,13 +746,21 @@ void controlling(void) {
           paused = false;
         }
         break;
+      case '6':
+        if(in_menu) {
+          gamemode = versus_computer;
+          in_menu = false;
+          gamestate = starting;
+          paused = false;
+        }
+        break;
       case '3':
         if(in_menu) {
           paused = true; //without a pause segfault here...fix
           gamemode = network_host;
           ip_hostname[0] = '\0'; nw_port[0] = '\0';
           in_menu = false;
-          input_box("Port:", nw_port);
+          input_box("Port:", nw_port, sizeof(nw_port));
           gamestate = starting;
           paused = false;
         }
@@ -714,22 +771,266 @@ void controlling(void) {
           gamemode = network_client;
           ip_hostname[0] = '\0'; nw_port[0] = '\0';
           in_menu = false;
-          input_box("IP or hostname", ip_hostname);
-          input_box("Port:", nw_port);
+          input_box("IP or hostname", ip_hostname, sizeof(ip_hostname));
+          input_box("Port:", nw_port, sizeof(nw_port));
+          gamestate = starting;
+          paused = false;
+        }
+        break;
+      case '5':
+        if(in_menu) {
+          paused = true;
+          gamemode = dedicated_client;
+          ip_hostname[0] = '\0'; nw_port[0] = '\0';
+          in_menu = false;
+          input_box("IP or hostname", ip_hostname, sizeof(ip_hostname));
+          input_box("Port:", nw_port, sizeof(nw_port));
+          gamestate = starting;
+          paused = false;
+        }
+        break;
+      case '7':
+        if(in_menu) {
+          paused = true;
+          gamemode = spectating;
+          ip_hostname[0] = '\0'; nw_port[0] = '\0';
+          in_menu = false;
+          input_box("IP or hostname", ip_hostname, sizeof(ip_hostname));
+          input_box("Port:", nw_port, sizeof(nw_port));
           gamestate = starting;
           paused = false;
         }
         break;
       case 27: //Esc-Key
         in_menu = !in_menu;
+        full_redraw = true;
+        break;
+      case KEY_RESIZE:
+        full_redraw = true;
         break;
     }
   }
   return;
 }
 
+// headless -------------------------------------------------------------------
+void steer_randomly(player* this_player) {
+  // turn left or right now and then, never reverse
+  if(!this_player || !this_player->is_alive || rand() % 8) return;
+  int turn = (rand() % 2) ? 1 : -1;
+  direction next = {0, turn};
+  if(!this_player->move_x) {
+    next.x = turn;
+    next.y = 0;
+  }
+  commands[this_player->number-1].push(next);
+}
+
+bool steer_scripted(FILE* script, long tick, long &next_tick) {
+  // a script line is "<tick> <player> <u|d|l|r>", sorted by tick
+  int number;
+  char letter;
+  while(next_tick == tick) {
+    if(fscanf(script, "%d %c", &number, &letter) != 2) return false;
+    if(number >= 1 && number <= (int)players.size()) {
+      direction turn;
+      turn.x = (letter=='l') ? -1 : (letter=='r') ? 1 : 0;
+      turn.y = (letter=='u') ? -1 : (letter=='d') ? 1 : 0;
+      commands[number-1].push(turn);
+    }
+    if(fscanf(script, "%ld", &next_tick) != 1) next_tick = -1;
+  }
+  return true;
+}
+
+int headless(long ticks, unsigned int seed, int number_of_players, const char* script_file) {
+  // run the simulation without ncurses and without waiting between ticks
+  FILE* script = NULL;
+  long next_tick = -1;
+  if(script_file) {
+    script = fopen(script_file, "r");
+    if(!script) error(script_file);
+    if(fscanf(script, "%ld", &next_tick) != 1) next_tick = -1;
+  }
+
+  srand(seed);
+  match_random.seed(seed);
+  gamemode = (number_of_players == 1) ? single : local_multi;
+  player_count = number_of_players;
+  level = (rand() % level_count());
+  new_round();
+  gamestate = running;
+  record_round();
+  long rounds = 1;
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for(long tick = 0; tick < ticks; tick++) {
+    PROFILE(phase_tick);
+    if(script) {
+      if(!steer_scripted(script, tick, next_tick)) {
+        fprintf(stderr, "%s: malformed line near tick %ld\n", script_file, tick);
+        return 1;
+      }
+    }
+    else {
+      for(int i = 0; i < (int)players.size() - computer_players; i++) steer_randomly(players[i]);
+    }
+    think();
+    simulate();
+    record_tick();
+    // start over as soon as everybody is dead
+    if(gamestate==stopping) {
+      level = (rand() % level_count());
+      new_round();
+      gamestate = running;
+      record_round();
+      rounds++;
+    }
+  }
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  printf("ticks:   %ld\n", ticks);
+  printf("rounds:  %ld\n", rounds);
+  printf("seconds: %.3f\n", elapsed.count());
+  printf("ticks/s: %.0f\n", ticks / (elapsed.count() > 0 ? elapsed.count() : 1e-9));
+  printf("hash:    %016llx\n", state_hash());
+
+  if(script) fclose(script);
+  finish_recording();
+  finish_trace();
+  food.clear();
+  clear_players();
+  forget_levels();
+  return 0;
+}
+
+int verify(const char* replay_file) {
+  // play a replay back as fast as possible and compare every snapshot in it
+  playback = new replay_reader(replay_file);
+  gamemode = replaying;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  playback->seek(0);
+  while(playback->step() != replay_end) {}
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  printf("ticks:      %ld\n", playback->tick());
+  printf("seconds:    %.3f\n", elapsed.count());
+  printf("ticks/s:    %.0f\n", playback->tick() / (elapsed.count() > 0 ? elapsed.count() : 1e-9));
+  printf("checks:     %ld\n", playback->checks);
+  printf("mismatches: %ld\n", playback->mismatches);
+  if(playback->broken) printf("a round or snapshot in the replay doesn't load\n");
+  else if(!playback->complete) printf("the replay ends early, it has no end record\n");
+
+  finish_trace();
+  bool good = playback->complete && !playback->mismatches;
+  delete playback;
+  playback = NULL;
+  food.clear();
+  clear_players();
+  forget_levels();
+  return good ? 0 : 1;
+}
+
+void usage(const char* name) {
+  fprintf(stderr, "usage: %s [--speed MS] [--overrun catch-up|skip] [--food N]\n"
+                  "          [--headless [--ticks N] [--seed S] [--size WxH]\n"
+                  "          [--players N] [--computer N] [--script FILE]]\n"
+                  "          [--dedicated PORT [--players N] [--size WxH]]\n"
+                  "          [--threads N] [--trace FILE] [--udp] [--spectators PORT]\n"
+                  "          [--record FILE] [--replay FILE [--verify]] [--levels FILE]\n"
+                  "          [--render ansi|curses] [--size WxH]\n", name);
+  exit(1);
+}
+
 //-----------------------------------------------------------------------------
-int main(void) {
+int main(int argc, char** argv) {
+  bool run_headless = false;
+  long ticks = 100000;
+  unsigned int seed = time(0);
+  int number_of_players = 0;
+  const char* script_file = NULL;
+  const char* dedicated_port = NULL;
+  const char* record_file = NULL;
+  const char* replay_file = NULL;
+  const char* spectator_port = NULL;
+  const char* levels_file = NULL;
+  bool run_verify = false;
+  bool render_ansi = true;
+  play_x = 80;
+  play_y = 40;
+  for(int i = 1; i < argc; i++) {
+    bool has_value = (i+1 < argc);
+    if(!strcmp(argv[i], "--headless")) run_headless = true;
+    else if(!strcmp(argv[i], "--dedicated") && has_value) dedicated_port = argv[++i];
+    else if(!strcmp(argv[i], "--ticks") && has_value) ticks = atol(argv[++i]);
+    else if(!strcmp(argv[i], "--seed") && has_value) seed = strtoul(argv[++i], NULL, 10);
+    else if(!strcmp(argv[i], "--players") && has_value) number_of_players = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--script") && has_value) script_file = argv[++i];
+    else if(!strcmp(argv[i], "--computer") && has_value) computer_players = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--speed") && has_value) gamespeed = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--food") && has_value) food_count = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--threads") && has_value) tick_threads = atoi(argv[++i]);
+    else if(!strcmp(argv[i], "--trace") && has_value) trace_file = argv[++i];
+    else if(!strcmp(argv[i], "--record") && has_value) record_file = argv[++i];
+    else if(!strcmp(argv[i], "--replay") && has_value) replay_file = argv[++i];
+    else if(!strcmp(argv[i], "--verify")) run_verify = true;
+    else if(!strcmp(argv[i], "--udp")) use_udp = true;
+    else if(!strcmp(argv[i], "--spectators") && has_value) spectator_port = argv[++i];
+    else if(!strcmp(argv[i], "--levels") && has_value) levels_file = argv[++i];
+    else if(!strcmp(argv[i], "--overrun") && has_value) {
+      const char* policy = argv[++i];
+      if(!strcmp(policy, "catch-up")) overrun_policy = catch_up;
+      else if(!strcmp(policy, "skip")) overrun_policy = skip;
+      else usage(argv[0]);
+    }
+    else if(!strcmp(argv[i], "--render") && has_value) {
+      const char* backend = argv[++i];
+      if(!strcmp(backend, "ansi")) render_ansi = true;
+      else if(!strcmp(backend, "curses")) render_ansi = false;
+      else usage(argv[0]);
+    }
+    else if(!strcmp(argv[i], "--size") && has_value) {
+      if(sscanf(argv[++i], "%dx%d", &play_x, &play_y) != 2) usage(argv[0]);
+      fixed_size = true;
+    }
+    else usage(argv[0]);
+  }
+  if(gamespeed < MIN_TICK_MS || gamespeed > MAX_TICK_MS) usage(argv[0]);
+  if(food_count < 0 || tick_threads < 1 || tick_threads > 256) usage(argv[0]);
+  if(run_headless || dedicated_port) {
+    if(!number_of_players) number_of_players = run_headless ? 2 : 8;
+    if(play_x < 8 || play_y < 8 || number_of_players < 1 || number_of_players > MAX_PLAYER_NUMBER) usage(argv[0]);
+  }
+  if(fixed_size && !run_headless && !dedicated_port && (play_x < 8 || play_y < 8 || (long)play_x * play_y > MAX_WATCHED_CELLS)) usage(argv[0]);
+  if(computer_players < 0 || (computer_players && (!run_headless || computer_players > number_of_players))) {
+    usage(argv[0]);
+  }
+  if(run_verify && !replay_file) usage(argv[0]);
+  if(replay_file && (record_file || run_headless || dedicated_port)) usage(argv[0]);
+  if(spectator_port && (run_headless || run_verify)) usage(argv[0]);
+  if(levels_file && !load_levels(levels_file)) {
+    fprintf(stderr, "%s: %s\n", levels_file, level_error.c_str());
+    return 1;
+  }
+  if(replay_file && run_verify) return verify(replay_file);
+  if(replay_file) {
+    playback = new replay_reader(replay_file);
+    gamemode = replaying;
+  }
+  if(record_file) recording = new replay_writer(record_file);
+  if(trace_file) profile.start_trace();
+  if(spectator_port) audience = new spectators(spectator_port);
+  if(run_headless) return headless(ticks, seed, number_of_players, script_file);
+  if(dedicated_port) {
+    srand(seed);
+    dedicated(dedicated_port, number_of_players, gamespeed).run();
+    delete audience;
+    finish_recording();
+    finish_trace();
+    forget_levels();
+    return 0;
+  }
+
   // init curses
   initscr();
   atexit(quit);
@@ -739,21 +1040,9 @@ int main(void) {
   keypad(stdscr, TRUE);
   start_color();
 
-  // set color pairs: id, chars_color, back_color
-  init_pair(WALL, COLOR_BLUE, COLOR_WHITE);
-  // player 1 colors
-  init_pair(WORMHEAD+10, COLOR_BLACK, COLOR_YELLOW);
-  init_pair(WORM+10, COLOR_CYAN, COLOR_YELLOW);
-  // player 2 colors
-  init_pair(WORMHEAD+20, COLOR_BLACK, COLOR_GREEN);
-  init_pair(WORM+20, COLOR_CYAN, COLOR_GREEN);
-  init_pair(FOOD, COLOR_WHITE, COLOR_BLUE);
-  //level backgrounds
-  init_pair(9, COLOR_WHITE, COLOR_BLACK);
-  init_pair(8, COLOR_BLACK, COLOR_WHITE);
-  //menu colors
-  init_pair(10, COLOR_WHITE, COLOR_BLACK);
-  init_pair(11, COLOR_BLACK, COLOR_WHITE);
+  init_colour_pairs();
+  if(render_ansi && ansi_renderer::fits_terminal()) screen = new ansi_renderer(STDOUT_FILENO);
+  else screen = new curses_renderer;
 
   // set background of main window
   bkgd(COLOR_PAIR(9));
@@ -769,7 +1058,12 @@ int main(void) {
   // do last clean up ... maybe better in quit()
   delwin(score_window);
   endwin();
-  if(playground) {delete[] playground; playground = NULL;}
+  delete screen;
+  delete audience;
+  finish_recording();
+  finish_trace();
+  forget_levels();
+  delete playback;
   return 0;
 }
 
@@ -0,0 +1,79 @@
+// the body of a worm is a ring buffer of positions. the head is pushed at one
+// end and the tail popped at the other, so moving never allocates. the buffer
+// only grows (by doubling) when the worm gets longer than it ever was.
+
+#include <stdlib.h>
+
+class wormpiece {
+  public:
+    int pos_x, pos_y;
+};
+
+class wormbody {
+  public:
+    wormbody(int initial_capacity = 64);
+    ~wormbody(void);
+    void push_head(int x, int y);
+    void pop_tail(void);
+    void clear(void);
+    int length(void) const {return (int)(head_index - tail_index);}
+    // at(0) is the head, at(length()-1) the tail
+    wormpiece& at(int i) {return pieces[(head_index - 1 - i) & mask];}
+    wormpiece& head(void) {return pieces[(head_index - 1) & mask];}
+    wormpiece& tail(void) {return pieces[tail_index & mask];}
+
+  private:
+    wormbody(const wormbody&);
+    wormbody& operator=(const wormbody&);
+    void grow(void);
+
+    wormpiece* pieces;
+    unsigned int mask;       // capacity - 1, capacity is a power of two
+    unsigned int head_index; // one behind the head, counts up forever
+    unsigned int tail_index; // the tail, counts up forever
+};
+
+wormbody::wormbody(int initial_capacity) {
+  unsigned int capacity = 1;
+  while(capacity < (unsigned int)initial_capacity) capacity *= 2;
+  pieces = new wormpiece[capacity];
+  mask = capacity - 1;
+  head_index = 0;
+  tail_index = 0;
+}
+
+wormbody::~wormbody(void) {
+  delete[] pieces;
+}
+
+void wormbody::grow(void) {
+  // copy the pieces tail first to the start of a buffer twice as big
+  unsigned int capacity = (mask + 1) * 2;
+  wormpiece* bigger = new wormpiece[capacity];
+  int count = length();
+  for(int i = 0; i < count; i++) {
+    bigger[i] = pieces[(tail_index + i) & mask];
+  }
+  delete[] pieces;
+  pieces = bigger;
+  mask = capacity - 1;
+  tail_index = 0;
+  head_index = count;
+}
+
+void wormbody::push_head(int x, int y) {
+  if(length() == (int)(mask + 1)) grow();
+  wormpiece& piece = pieces[head_index & mask];
+  piece.pos_x = x;
+  piece.pos_y = y;
+  head_index++;
+}
+
+void wormbody::pop_tail(void) {
+  if(length() > 0) tail_index++;
+}
+
+void wormbody::clear(void) {
+  head_index = 0;
+  tail_index = 0;
+}
@@ -0,0 +1,6 @@
+#ifndef WORM_WORMBODY_H
+#define WORM_WORMBODY_H
+class wormpiece;
+class wormbody;
+#include "wormbody.cpp"
+#endif